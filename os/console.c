@@ -4,6 +4,7 @@
 #include "defs.h"
 #include "riscv-io.h"
 #include "sbi.h"
+#include "workqueue.h"
 
 int uart0_irq;
 static int uart_inited = false;
@@ -11,9 +12,11 @@ static void uart_putchar(int);
 extern void acquire_kprint(void);
 extern void release_kprint(void);
 
-static struct spinlock uart_tx_lock;
+static mutex_t uart_tx_mutex;
 volatile int panicked = 0;
 
+#define CONS_WRITE_CHUNK 64  // bytes a user write prints at once
+
 #define BACKSPACE 0x100
 #define C(x)      ((x) - '@')  // Control-x
 
@@ -28,6 +31,14 @@ struct {
     uint e;  // Edit index
 } cons;
 
+// Waking readers is deferred to the worker.
+//  The ^P/^Q dumps stay in the interrupt handler, as they are most needed when the scheduler is stuck.
+static void cons_wakeup_work(struct work *w) {
+    wakeup(&cons);
+}
+
+static struct work cons_wakeup;
+
 void consputc(int c) {
     if (!uart_inited || panicked)  // when panicked, use SBI output
         sbi_putchar(c);
@@ -86,8 +97,9 @@ static int uartgetc(void) {
 
 void console_init() {
     assert(!uart_inited);
-    spinlock_init(&uart_tx_lock, "uart_tx");
+    mutex_init(&uart_tx_mutex, "uart_tx");
     spinlock_init(&cons.lock, "cons");
+    work_init(&cons_wakeup, cons_wakeup_work);
 
     // no need to init uart8250, they are already inited by OpenSBI.
 
@@ -145,7 +157,7 @@ static void consintr(int c) {
                     // wake up consoleread() if a whole line (or end-of-file)
                     // has arrived.
                     cons.w = cons.e;
-                    wakeup(&cons);
+                    queue_work(&cons_wakeup);
                 }
             }
             break;
@@ -181,26 +193,31 @@ int64 user_console_write(uint64 __user buf, int64 len) {
 
     acquire(&p->lock);
     mm = p->mm;
-    acquire(&mm->lock);
+    read_lock(&mm->lock);
     release(&p->lock);
 
     if ((ret = copy_from_user(mm, kbuf, buf, len)) < 0) {
-        release(&mm->lock);
+        read_unlock(&mm->lock);
         goto err;
     }
-    release(&mm->lock);
+    read_unlock(&mm->lock);
 
-    // do not interfere with kernel panic's print.
-    acquire_kprint();
     // do not interfere with other user's print.
-    acquire(&uart_tx_lock);
-
-    for (int64 i = 0; i < len; i++) {
-        consputc(kbuf[i]);
+    //  A page takes long to drain through the uart: other writers sleep meanwhile instead of spinning.
+    mutex_lock(&uart_tx_mutex);
+    for (int64 i = 0; i < len; i += CONS_WRITE_CHUNK) {
+        // do not interfere with kernel panic's print, which is only held off for a chunk.
+        //  Interrupts are off meanwhile, as a handler may print.
+        push_off();
+        acquire_kprint();
+        for (int64 j = i; j < MIN(len, i + CONS_WRITE_CHUNK); j++) {
+            consputc(kbuf[j]);
+        }
+        release_kprint();
+        pop_off();
+        cond_resched();
     }
-
-    release(&uart_tx_lock);
-    release_kprint();
+    mutex_unlock(&uart_tx_mutex);
 
     kfreepage((void*)KVA_TO_PA(kbuf));
     return len;
@@ -245,14 +262,14 @@ int64 user_console_read(uint64 __user buf, int64 n) {
         struct proc *p = curr_proc();
         acquire(&p->lock);
         struct mm *mm = p->mm;
-        acquire(&mm->lock);
+        read_lock(&mm->lock);
         release(&p->lock);
 
         if (copy_to_user(mm, (uint64)buf, &cbuf, 1) < 0) {
-            release(&mm->lock);
+            read_unlock(&mm->lock);
             break;
         }
-        release(&mm->lock);
+        read_unlock(&mm->lock);
 
         buf++;
         --n;
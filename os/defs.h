@@ -21,7 +21,10 @@
 // Kernel defines
 #define ENABLE_SMP    (1)
 #define NCPU          (4)
+#define ISOLATED_CPUS (0)      // mask of the cpus isolated at boot, see sched_isolate()
 #define NPROC         (512)
+#define PID_MAX       (32768)  // pids are in [1, PID_MAX)
+#define PIDHASH_SIZE  (256)    // must be a power of 2
 #define KSTRING_MAX   (256)
 #define MAXARG        (32)
 #define PHYS_MEM_SIZE (128ull * 1024 * 1024)
@@ -0,0 +1,81 @@
+#include "fpu.h"
+
+#include "defs.h"
+
+// Lazy floating-point context.
+//
+// Most processes never touch the FP registers, so they run with sstatus.FS = Off,
+//  and don't pay for saving or restoring them. Their first FP instruction traps,
+//  and fpu_first_use() enables FP for them from then on.
+// For the others, the FP registers of a cpu hold the state of mycpu()->fp_owner,
+//  if that process agrees, i.e., its p->fp_cpu is this cpu.
+//  - the registers are saved to p->fpstate when p leaves the cpu, only if they are Dirty.
+//  - they are restored when returning to user, only if p is not the owner.
+// The kernel itself never uses FP.
+
+static inline void set_fs(uint64 fs) {
+    w_sstatus((r_sstatus() & ~SSTATUS_FS) | fs);
+}
+
+static inline uint64 get_fs() {
+    return r_sstatus() & SSTATUS_FS;
+}
+
+// An illegal instruction from user. Returns 1 if it was p's first FP instruction.
+int fpu_first_use(struct proc *p) {
+    if (p->fp_used || get_fs() != SSTATUS_FS_OFF)
+        return 0;
+    p->fp_used = 1;
+    // fpstate is all zeros, the same as the registers at reset.
+    //  fpu_return_to_user() loads it, as we are not its owner.
+    return 1;
+}
+
+// p is leaving the cpu, in sched().
+void fpu_switch_out(struct proc *p) {
+    if (get_fs() != SSTATUS_FS_DIRTY)
+        return;
+    // only p's user code ran since it trapped, so the registers are p's,
+    //  unless p has exited, or exec()-ed and they are the old program's.
+    if (p->fp_used && p->fp_cpu == mycpu()->cpuid && p->state != ZOMBIE)
+        fpu_save_regs(&p->fpstate);
+    set_fs(SSTATUS_FS_CLEAN);
+}
+
+void fpu_return_to_user(struct proc *p) {
+    struct cpu *c = mycpu();
+
+    if (!p->fp_used) {
+        set_fs(SSTATUS_FS_OFF);
+        return;
+    }
+    if (c->fp_owner != p || p->fp_cpu != c->cpuid) {
+        set_fs(SSTATUS_FS_CLEAN);
+        fpu_restore_regs(&p->fpstate);
+        c->fp_owner = p;
+        p->fp_cpu   = c->cpuid;
+        // fld sets FS to Dirty.
+        set_fs(SSTATUS_FS_CLEAN);
+    } else if (get_fs() == SSTATUS_FS_OFF) {
+        // the registers are still ours, an integer-only process ran in between.
+        set_fs(SSTATUS_FS_CLEAN);
+    }
+}
+
+// The child of fork() gets a copy of our FP state.
+void fpu_fork(struct proc *p, struct proc *np) {
+    if (get_fs() == SSTATUS_FS_DIRTY) {
+        fpu_save_regs(&p->fpstate);
+        set_fs(SSTATUS_FS_CLEAN);
+    }
+    np->fpstate = p->fpstate;
+    np->fp_used = p->fp_used;
+    np->fp_cpu  = -1;
+}
+
+// A new process, or exec(): no FP state.
+void fpu_reset(struct proc *p) {
+    memset(&p->fpstate, 0, sizeof(p->fpstate));
+    p->fp_used = 0;
+    p->fp_cpu  = -1;
+}
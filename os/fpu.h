@@ -0,0 +1,23 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+
+struct proc;
+
+// Floating-point registers of a process, saved by fpu.S.
+struct fpstate {
+    /*   0 */ uint64 f[32];
+    /* 256 */ uint64 fcsr;
+};
+
+void fpu_save_regs(struct fpstate *fp);
+void fpu_restore_regs(struct fpstate *fp);
+
+int fpu_first_use(struct proc *p);
+void fpu_switch_out(struct proc *p);
+void fpu_return_to_user(struct proc *p);
+void fpu_fork(struct proc *p, struct proc *np);
+void fpu_reset(struct proc *p);
+
+#endif  // FPU_H
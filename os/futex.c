@@ -0,0 +1,120 @@
+#include "futex.h"
+
+#include "defs.h"
+#include "timer.h"
+#include "waitqueue.h"
+
+// Futexes are keyed by the physical address of the user word,
+//  so that processes sharing the page through different mappings meet on the same futex.
+//  A futex sleeps on the wait queue of its hash bucket, with the key as the channel.
+//  bucket->lock makes checking the user word and going to sleep atomic against futex_wake().
+#define FUTEX_HASH_BITS (6)
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+struct futex_bucket {
+    spinlock_t lock;
+    struct wait_queue wq;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASH_SIZE];
+
+static inline struct futex_bucket *key_bucket(uint64 key) {
+    uint64 h = key * 0x9e3779b97f4a7c15UL;
+    return &futex_table[h >> (64 - FUTEX_HASH_BITS)];
+}
+
+void futex_init() {
+    for (int i = 0; i < FUTEX_HASH_SIZE; i++) {
+        spinlock_init(&futex_table[i].lock, "futex");
+        wait_queue_init(&futex_table[i].wq, "futex-wq");
+    }
+}
+
+// Translate a user address to its futex key, the physical address. Returns 0 if it is invalid.
+static uint64 futex_key(uint64 __user uaddr) {
+    if (uaddr & 3)
+        return 0;
+
+    struct proc *p = curr_proc();
+    acquire(&p->lock);
+    read_lock(&p->mm->lock);
+    release(&p->lock);
+    uint64 key = IS_USER_VA(uaddr) ? useraddr(p->mm, uaddr) : 0;
+    read_unlock(&p->mm->lock);
+    return key;
+}
+
+struct futex_timer {
+    struct ktimer timer;
+    struct futex_bucket *bucket;
+    struct proc *p;
+    int expired;
+};
+
+static void futex_timer_fn(struct ktimer *t) {
+    struct futex_timer *ft = container_of(t, struct futex_timer, timer);
+
+    // the waiter checks `expired` under bucket->lock before going to sleep,
+    //  so either it sees the flag or we see it SLEEPING.
+    //  It is unlinked from the queue, or a later futex_wake() could count it instead of a real sleeper.
+    acquire(&ft->bucket->lock);
+    ft->expired = 1;
+    wait_queue_wake_proc(&ft->bucket->wq, ft->p);
+    release(&ft->bucket->lock);
+}
+
+/// Sleep on the futex at uaddr if it still holds val, for at most `timeout` cycles if non-zero.
+///  Returns 0 when woken up by futex_wake(), -EAGAIN if *uaddr != val,
+///  -ETIMEDOUT on timeout, or -EINTR if killed.
+int futex_wait(uint64 __user uaddr, int val, uint64 timeout) {
+    uint64 key = futex_key(uaddr);
+    if (key == 0)
+        return -EINVAL;
+
+    struct proc *p          = curr_proc();
+    struct futex_bucket *fb = key_bucket(key);
+    struct futex_timer ft;
+    int ret = 0;
+
+    ft.bucket  = fb;
+    ft.p       = p;
+    ft.expired = 0;
+    ktimer_init(&ft.timer, futex_timer_fn);
+
+    acquire(&fb->lock);
+    // the page may have been unmapped since futex_key(), reading it is harmless then.
+    if (*(volatile int *)PA_TO_KVA(key) != val) {
+        release(&fb->lock);
+        return -EAGAIN;
+    }
+    if (timeout)
+        ktimer_add(&ft.timer, get_cycle() + timeout);
+    if (!ft.expired)
+        wait_queue_sleep(&fb->wq, (void *)key, &fb->lock);
+    if (ft.expired)
+        ret = -ETIMEDOUT;
+    release(&fb->lock);
+
+    // ft is on our stack, make sure the callback is done with it.
+    if (timeout)
+        ktimer_cancel(&ft.timer);
+    if (ret == 0 && iskilled(p))
+        ret = -EINTR;
+    return ret;
+}
+
+/// Wake up at most nr processes sleeping on the futex at uaddr.
+///  Returns the number of processes woken up.
+int futex_wake(uint64 __user uaddr, int nr) {
+    uint64 key = futex_key(uaddr);
+    if (key == 0)
+        return -EINVAL;
+    if (nr <= 0)
+        return 0;
+
+    struct futex_bucket *fb = key_bucket(key);
+    acquire(&fb->lock);
+    int woken = wait_queue_wake_nr(&fb->wq, (void *)key, nr);
+    release(&fb->lock);
+    return woken;
+}
@@ -0,0 +1,11 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "types.h"
+#include "vm.h"
+
+void futex_init();
+int futex_wait(uint64 __user uaddr, int val, uint64 timeout);
+int futex_wake(uint64 __user uaddr, int nr);
+
+#endif  // FUTEX_H
@@ -1,15 +1,26 @@
 #include "kalloc.h"
 
 #include "defs.h"
+#include "workqueue.h"
 
 struct linklist {
     struct linklist *next;
 };
 
+// Free pages are kept in two lists: the junk-filled freelist, and a pool of zeroed pages
+//  refilled by zero_work in the background, so that page tables and anonymous memory
+//  don't pay for a memset in the fault or syscall path. Both count in freepages_count.
+#define ZERO_POOL_LOW  (16)  // refill when the pool drops below this
+#define ZERO_POOL_HIGH (64)  // refill up to this
+
 struct {
     struct linklist *freelist;
+    struct linklist *zerolist;
+    int nr_zeroed;
 } kmem;
 
+static struct work zero_work;
+
 int kalloc_inited = 0;
 
 extern uint64 __kva kpage_allocator_base;
@@ -17,8 +28,32 @@ extern uint64 __kva kpage_allocator_size;
 static spinlock_t kpagelock;
 int64 freepages_count;
 
+// Move pages from the freelist to the zero pool, zeroing them without kpagelock.
+static void zero_pool_refill(struct work *w) {
+    for (;;) {
+        acquire(&kpagelock);
+        struct linklist *l = kmem.freelist;
+        if (kmem.nr_zeroed >= ZERO_POOL_HIGH || l == NULL) {
+            release(&kpagelock);
+            return;
+        }
+        kmem.freelist = l->next;
+        freepages_count--;
+        release(&kpagelock);
+
+        memset((char *)l, 0, PGSIZE);
+
+        acquire(&kpagelock);
+        l->next       = kmem.zerolist;
+        kmem.zerolist = l;
+        kmem.nr_zeroed++;
+        freepages_count++;
+        release(&kpagelock);
+    }
+}
+
 void kpgmgrinit() {
-    spinlock_init(&kpagelock, "pageallocator");
+    spinlock_init_mcs(&kpagelock, "pageallocator");
 
     uint64 kpage_allocator_end = kpage_allocator_base + kpage_allocator_size;
 
@@ -30,6 +65,7 @@ void kpgmgrinit() {
     for (uint64 p = kpage_allocator_end - PGSIZE; p >= kpage_allocator_base; p -= PGSIZE) {
         kfreepage((void *)KVA_TO_PA(p));
     }
+    work_init(&zero_work, zero_pool_refill);
     kalloc_inited = 1;
 }
 
@@ -69,6 +105,11 @@ void *__pa kallocpage() {
     if (l) {
         kmem.freelist = l->next;
         freepages_count--;
+    } else if ((l = kmem.zerolist) != NULL) {
+        // only zeroed pages are left.
+        kmem.zerolist = l->next;
+        kmem.nr_zeroed--;
+        freepages_count--;
     }
     release(&kpagelock);
     
@@ -83,6 +124,34 @@ void *__pa kallocpage() {
     return (void *)KVA_TO_PA((uint64)l);
 }
 
+// Allocate one zeroed page of physical memory, preferably from the zero pool.
+// Returns 0 if the memory cannot be allocated.
+void *__pa kallocpage_zeroed() {
+    acquire(&kpagelock);
+    struct linklist *l = kmem.zerolist;
+    if (l) {
+        kmem.zerolist = l->next;
+        kmem.nr_zeroed--;
+        freepages_count--;
+    }
+    int refill = kmem.nr_zeroed < ZERO_POOL_LOW && kmem.freelist != NULL;
+    release(&kpagelock);
+
+    if (refill)
+        queue_work(&zero_work);
+
+    if (l != NULL) {
+        l->next = NULL;  // the only word not zeroed by now
+        return (void *)KVA_TO_PA((uint64)l);
+    }
+
+    // the pool is empty, zero one here.
+    void *pa = kallocpage();
+    if (pa != NULL)
+        memset((void *)PA_TO_KVA(pa), 0, PGSIZE);
+    return pa;
+}
+
 // Object Allocator
 static uint64 allocator_mapped_va = KERNEL_ALLOCATOR_BASE;
 
@@ -97,7 +166,7 @@ void allocator_init(struct allocator *alloc, char *name, uint64 object_size, uin
     memset(alloc, 0, sizeof(*alloc));
     // record basic properties of the allocator
     alloc->name = name;
-    spinlock_init(&alloc->lock, "allocator");
+    spinlock_init_mcs(&alloc->lock, "allocator");
     alloc->object_size         = object_size;
     alloc->object_size_aligned = ROUNDUP_2N(object_size + sizeof(struct linklist), 8);
     alloc->max_count           = count;
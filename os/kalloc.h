@@ -6,6 +6,7 @@
 void kpgmgrinit();
 void kfreepage(void *pa);
 void *__pa kallocpage();
+void *__pa kallocpage_zeroed();
 
 // Object Allocator:
 
@@ -8,5 +8,17 @@ uint64 ktest_syscall(uint64 args[6]);
 #define KTEST_PRINT_KERNPGT 2
 #define KTEST_GET_NRFREEPGS 3
 #define KTEST_GET_NRSTRBUF  4
+#define KTEST_PRINT_CPUSTAT 5
+#define KTEST_SET_DIRECT_SWITCH 6
+#define KTEST_SET_PREEMPT       7  // arg: PREEMPT_NONE 0, PREEMPT_VOLUNTARY 1, PREEMPT_FULL 2
+#define KTEST_PRINT_LATHIST     8  // arg: 1 to reset the histogram instead
+#define KTEST_LOCKBENCH         9  // arg: kind | nr << 8, len: duration in us
+#define KTEST_PRINT_LOCKSTAT    10  // arg: 1 to reset the statistics instead. -EINVAL unless built with LOCKSTAT=y
+#define KTEST_QUEUE_STRESS      11  // arg: nr of harts taking part, 0 to reset the queue. len: pushes per hart
+
+// lock kinds of KTEST_LOCKBENCH
+#define LOCKBENCH_TAS    0  // test-and-set, the old acquire()
+#define LOCKBENCH_TICKET 1
+#define LOCKBENCH_MCS    2
 
 #endif  // __KTEST_H__
\ No newline at end of file
@@ -1,8 +1,159 @@
 #include "defs.h"
 #include "ktest.h"
+#include "queue.h"
+#include "trap.h"
+#include "workqueue.h"
 
 extern int64 freepages_count;
 extern allocator_t kstrbuf;
+extern int sched_direct_switch;
+extern int sched_preempt;
+
+static void print_cpustat() {
+    const uint64 cycles_per_ms = CPU_FREQ / 1000;
+    const uint64 cycles_per_us = CPU_FREQ / 1000000;
+    uint64 now_ms              = r_time() / cycles_per_ms;
+    printf("ticks %d\n", (int)get_ticks());
+    for (int i = 0; i < NCPU; i++) {
+        struct cpu *c = getcpu(i);
+        printf("cpu %d: idle %d/%d ms, wfi %d, spurious wakeups %d, timer interrupts %d, IPIs %d, migrations %d, "
+               "kernel preemptions %d\n", i,
+               (int)(c->idle_cycles / cycles_per_ms), (int)now_ms, (int)c->nr_idle, (int)c->nr_spurious,
+               (int)c->nr_timer_intr, (int)c->nr_ipi, (int)c->nr_migrations, (int)c->nr_preempt);
+        if (c->nr_wakeups > 0)
+            printf("       %d wakeups, latency avg %d us, max %d us\n", (int)c->nr_wakeups,
+                   (int)(c->wakeup_lat_sum / c->nr_wakeups / cycles_per_us), (int)(c->wakeup_lat_max / cycles_per_us));
+    }
+}
+
+// wakeup latency histogram of all cpus, since the last reset.
+static void print_lathist(int reset) {
+    uint64 hist[LAT_HIST_BUCKETS] = {0};
+    uint64 total                  = 0;
+    for (int i = 0; i < NCPU; i++) {
+        struct cpu *c = getcpu(i);
+        for (int b = 0; b < LAT_HIST_BUCKETS; b++) {
+            hist[b] += c->wakeup_lat_hist[b];
+            total += c->wakeup_lat_hist[b];
+            if (reset)
+                c->wakeup_lat_hist[b] = 0;
+        }
+    }
+    if (reset)
+        return;
+    printf("wakeup latency, %d wakeups:\n", (int)total);
+    for (int b = 0; b < LAT_HIST_BUCKETS; b++) {
+        if (hist[b] == 0)
+            continue;
+        if (b == 0)
+            printf("  < 1 us: %d\n", (int)hist[b]);
+        else if (b == LAT_HIST_BUCKETS - 1)
+            printf("  >= %d us: %d\n", 1 << (b - 1), (int)hist[b]);
+        else
+            printf("  %d - %d us: %d\n", 1 << (b - 1), 1 << b, (int)hist[b]);
+    }
+}
+
+// lock microbenchmark, see user/src/lockbench.c.
+//  nr processes on different harts enter together, then take and release a lock of the given kind for `us`.
+//  Returns how many times this one took it.
+static uint64 bench_tas;
+static spinlock_t bench_ticket = {.name = "bench-ticket"};
+static spinlock_t bench_mcs    = {.name = "bench-mcs", .mcs = 1};
+static uint64 bench_shared;  // what the locks protect
+static uint64 bench_arrived;
+
+// Wait for the other nr - 1 processes of this round. Returns our arrival number, from 1.
+static uint64 bench_enter(uint64 *arrived, int nr) {
+    uint64 me        = __atomic_add_fetch(arrived, 1, __ATOMIC_ACQ_REL);
+    uint64 round_end = (me + nr - 1) / nr * nr;
+    while (__atomic_load_n(arrived, __ATOMIC_ACQUIRE) < round_end)
+        cpu_relax();
+    return me;
+}
+
+static uint64 lockbench(int kind, int nr, uint64 us) {
+    bench_enter(&bench_arrived, nr);
+
+    uint64 end = r_time() + us * (CPU_FREQ / 1000000);
+    uint64 n   = 0;
+    while (r_time() < end) {
+        if (kind == LOCKBENCH_TAS) {
+            push_off();
+            while (__sync_lock_test_and_set(&bench_tas, 1) != 0)
+                ;
+            bench_shared++;
+            __sync_lock_release(&bench_tas);
+            pop_off();
+        } else {
+            spinlock_t *lk = kind == LOCKBENCH_MCS ? &bench_mcs : &bench_ticket;
+            acquire(lk);
+            bench_shared++;
+            release(lk);
+        }
+        n++;
+    }
+    return n;
+}
+
+// MPMC queue stress test, see user/src/queuetest.c.
+//  nr processes on different harts each push `ops` distinct values to a small queue, popping one after each push,
+//  and more while it is full. The last one to finish drains the queue, and checks that every value came out once.
+//  Returns 0, or -EINVAL if values were lost or duplicated.
+#define STRESS_QUEUE_SIZE (64)
+
+static struct queue_slot stress_slots[STRESS_QUEUE_SIZE];
+static struct queue stress_queue;
+static uint64 stress_arrived, stress_done;
+static uint64 stress_pushed_sum, stress_pushed_xor, stress_popped_sum, stress_popped_xor;
+
+static void queue_stress_reset() {
+    init_queue(&stress_queue, stress_slots, STRESS_QUEUE_SIZE);
+    stress_arrived = stress_done = 0;
+    stress_pushed_sum = stress_pushed_xor = stress_popped_sum = stress_popped_xor = 0;
+}
+
+static int64 queue_stress(int nr, uint64 ops) {
+    uint64 me         = bench_enter(&stress_arrived, nr);
+    uint64 pushed_sum = 0, pushed_xor = 0, popped_sum = 0, popped_xor = 0;
+    struct queue *q   = &stress_queue;
+    void *data;
+
+    for (uint64 i = 0; i < ops; i++) {
+        uint64 v = me << 32 | (i + 1);  // distinct, and never NULL
+        while (push_queue(q, (void *)v) < 0) {
+            if ((data = pop_queue(q)) != NULL) {
+                popped_sum += (uint64)data;
+                popped_xor ^= (uint64)data;
+            }
+        }
+        pushed_sum += v;
+        pushed_xor ^= v;
+        if ((data = pop_queue(q)) != NULL) {
+            popped_sum += (uint64)data;
+            popped_xor ^= (uint64)data;
+        }
+    }
+
+    __atomic_fetch_add(&stress_pushed_sum, pushed_sum, __ATOMIC_RELAXED);
+    __atomic_fetch_xor(&stress_pushed_xor, pushed_xor, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stress_popped_sum, popped_sum, __ATOMIC_RELAXED);
+    __atomic_fetch_xor(&stress_popped_xor, popped_xor, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&stress_done, 1, __ATOMIC_ACQ_REL) < nr)
+        return 0;
+
+    // the others are done with the queue.
+    while ((data = pop_queue(q)) != NULL) {
+        stress_popped_sum += (uint64)data;
+        stress_popped_xor ^= (uint64)data;
+    }
+    if (stress_popped_sum != stress_pushed_sum || stress_popped_xor != stress_pushed_xor) {
+        errorf("queue stress: pushed sum %p xor %p, popped sum %p xor %p", stress_pushed_sum, stress_pushed_xor,
+               stress_popped_sum, stress_popped_xor);
+        return -EINVAL;
+    }
+    return 0;
+}
 
 uint64 ktest_syscall(uint64 args[6]) {
     uint64 which = args[0];
@@ -14,9 +165,37 @@ uint64 ktest_syscall(uint64 args[6]) {
             vm_print(kernel_pagetable);
             break;
         case KTEST_GET_NRFREEPGS:
+            // count the pages of exited processes, whose mm is freed by the workers.
+            flush_workqueues();
             return freepages_count;
         case KTEST_GET_NRSTRBUF:
             return kstrbuf.available_count;
+        case KTEST_PRINT_CPUSTAT:
+            print_cpustat();
+            break;
+        case KTEST_SET_DIRECT_SWITCH:
+            sched_direct_switch = args[1];
+            break;
+        case KTEST_SET_PREEMPT:
+            if (args[1] > PREEMPT_FULL)
+                return -EINVAL;
+            sched_preempt = args[1];
+            break;
+        case KTEST_PRINT_LATHIST:
+            print_lathist(args[1]);
+            break;
+        case KTEST_LOCKBENCH:
+            if ((args[1] & 0xff) > LOCKBENCH_MCS || (args[1] >> 8) == 0)
+                return -EINVAL;
+            return lockbench(args[1] & 0xff, args[1] >> 8, args[2]);
+        case KTEST_PRINT_LOCKSTAT:
+            return lockstat_print(args[1]);
+        case KTEST_QUEUE_STRESS:
+            if (args[1] == 0)
+                queue_stress_reset();
+            else
+                return queue_stress(args[1], args[2]);
+            break;
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef LIST_H
+#define LIST_H
+
+#include "types.h"
+
+// Intrusive doubly-linked circular list, in the style of Linux's list_head.
+// Embed a `struct list_head` in the object, and use list_entry() to get back
+// to the object. The caller is responsible for locking.
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
+#define list_entry(ptr, type, member)   container_of(ptr, type, member)
+
+#define list_first_entry(head, type, member) list_entry((head)->next, type, member)
+
+#define list_for_each_entry(pos, head, member)                      \
+    for (pos = list_entry((head)->next, typeof(*pos), member);      \
+         &pos->member != (head);                                    \
+         pos = list_entry(pos->member.next, typeof(*pos), member))
+
+// like list_for_each_entry, but `pos` may be removed from the list in the loop body.
+#define list_for_each_entry_safe(pos, n, head, member)              \
+    for (pos = list_entry((head)->next, typeof(*pos), member),      \
+        n    = list_entry(pos->member.next, typeof(*pos), member);  \
+         &pos->member != (head);                                    \
+         pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+static inline void list_init(struct list_head *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev, struct list_head *next) {
+    next->prev = new;
+    new->next  = next;
+    new->prev  = prev;
+    prev->next = new;
+}
+
+// insert `new` right after `head`.
+static inline void list_add(struct list_head *new, struct list_head *head) {
+    __list_add(new, head, head->next);
+}
+
+// insert `new` right before `head`, i.e., at the tail of the list.
+static inline void list_add_tail(struct list_head *new, struct list_head *head) {
+    __list_add(new, head->prev, head);
+}
+
+// unlink `entry`, and make it an empty list so that list_empty(entry) holds.
+static inline void list_del(struct list_head *entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    list_init(entry);
+}
+
+#endif  // LIST_H
@@ -30,20 +30,20 @@ struct user_app *get_elf(char *name) {
  * 
  * If succeed, the process's mm is freed and set to a new struct mm.
  * Otherwise, the process's mm is unchanged.
+ * Called without p->lock: building the new mm takes a while, and it may be preempted meanwhile.
  */
 int load_user_elf(struct user_app *app, struct proc *p, char *args[]) {
     if (p == NULL || p->state == UNUSED)
         panic("...");
 
     // create a new mm for the process
-    struct mm *new_mm = mm_create(p->trapframe);
+    struct mm *new_mm = mm_create(p->trapframe, TRAPFRAME_VA(p->index));
     if (new_mm == NULL) {
         errorf("mm_create");
         return -ENOMEM;
     }
 
     struct vma* vma_brk;
-    uint64 brk;
     int ret;
 
     Elf64_Ehdr *ehdr      = (Elf64_Ehdr *)app->elf_address;
@@ -92,6 +92,9 @@ int load_user_elf(struct user_app *app, struct proc *p, char *args[]) {
             }
             file_off += copy_size;
             file_remains -= copy_size;
+
+            // new_mm is only known to us until it's installed.
+            cond_resched_write_lock(&new_mm->lock);
         }
 
         if (phdr->p_memsz > phdr->p_filesz) {
@@ -107,6 +110,7 @@ int load_user_elf(struct user_app *app, struct proc *p, char *args[]) {
                 uint64 clear_size = PGROUNDUP(va) - va;
                 void *__kva pa    = (void *)PA_TO_KVA(walkaddr(new_mm, PGROUNDDOWN(va)));
                 memset(pa + page_off, 0, clear_size);
+                cond_resched_write_lock(&new_mm->lock);
             }
         }
 
@@ -123,7 +127,8 @@ int load_user_elf(struct user_app *app, struct proc *p, char *args[]) {
         errorf("mm_mappages vma_brk");
         goto bad;
     }
-    brk = max_va_end;
+    new_mm->vma_brk = vma_brk;
+    new_mm->brk     = max_va_end;
 
     // setup stack
     struct vma *vma_ustack = mm_create_vma(new_mm);
@@ -170,23 +175,26 @@ int load_user_elf(struct user_app *app, struct proc *p, char *args[]) {
     sp               = sp & ~15;  // aligned to 16 bytes
     assert(IS_ALIGNED(sp, 16));
 
-    release(&new_mm->lock);
+    write_unlock(&new_mm->lock);
+
+    acquire(&p->lock);
+    struct mm *old_mm = p->mm;
+    p->mm             = new_mm;
+    release(&p->lock);
 
-    // free the old mm. for the first process, p->mm = NULL.
-    if (p->mm) {
-        acquire(&p->mm->lock);
-        mm_free(p->mm);    
+    // drop the old mm, which a vfork() parent may still use. for the first process, p->mm = NULL.
+    if (old_mm) {
+        write_lock(&old_mm->lock);
+        mm_put(old_mm, TRAPFRAME_VA(p->index));
     }
-    
+
     // we can modify p's fields because we will return to the new exec-ed process.
-    p->mm      = new_mm;
-    p->vma_brk = vma_brk;
-    p->brk     = brk;
     // setup trapframe
     p->trapframe->sp  = sp;
     p->trapframe->epc = ehdr->e_entry;
     p->trapframe->a0  = argc;
     p->trapframe->a1  = uargv_ptr;
+    p->trapframe->tp  = 0;  // thread pointer, NULL for the main thread
 
     return 0;
 
@@ -212,11 +220,13 @@ int load_init_app() {
         panic("allocproc");
     }
     infof("load init proc %s", INIT_PROC);
+    release(&p->lock);
 
     char *argv[] = {NULL};
     if (load_user_elf(app, p, argv) < 0) {
         panic("fail to load init elf.");
     }
+    acquire(&p->lock);
     p->state          = RUNNABLE;
     add_task(p);
     init_proc = p;
@@ -2,12 +2,226 @@
 
 #include "defs.h"
 
+#ifdef LOCKSTAT
+// Lock contention statistics, built with `make LOCKSTAT=y`.
+// Spinlocks are grouped in classes by name, e.g. all "proc" locks,
+// and each cpu counts into its own slot of a class, so that counting doesn't add contention.
+#define LOCKSTAT_CLASSES (64)
+#define LOCKSTAT_NAME_MAX (32)
+
+struct lock_class_stat {
+	uint64 nr_acquire;	// acquisitions
+	uint64 nr_contended;	// acquisitions that had to wait
+	uint64 spin_cycles;	// time spent waiting
+	uint64 hold_max;	// longest time held
+};
+
+struct lock_class {
+	char *name;
+	struct lock_class_stat stat[NCPU];
+};
+
+static struct lock_class lock_classes[LOCKSTAT_CLASSES];
+static int nr_lock_classes;
+static spinlock_t lock_classes_lock;	// zeroed, so that it doesn't count itself
+
+static struct lock_class *lockstat_class(char *name)
+{
+	struct lock_class *class = NULL;
+	if (name == NULL)
+		return NULL;
+
+	acquire(&lock_classes_lock);
+	for (int i = 0; i < nr_lock_classes; i++) {
+		if (strncmp(lock_classes[i].name, name, LOCKSTAT_NAME_MAX) == 0) {
+			class = &lock_classes[i];
+			break;
+		}
+	}
+	if (class == NULL && nr_lock_classes < LOCKSTAT_CLASSES) {
+		class = &lock_classes[nr_lock_classes++];
+		class->name = name;
+	}
+	release(&lock_classes_lock);
+	return class;
+}
+
+static inline uint64 lockstat_start(void)
+{
+	return r_time();
+}
+
+static void lockstat_acquired(spinlock_t *lk, int contended, uint64 start)
+{
+	uint64 now = r_time();
+	lk->acquired_at = now;
+	if (lk->class == NULL)
+		return;
+	struct lock_class_stat *st = &lk->class->stat[cpuid()];
+	st->nr_acquire++;
+	if (contended) {
+		st->nr_contended++;
+		st->spin_cycles += now - start;
+	}
+}
+
+static void lockstat_released(spinlock_t *lk)
+{
+	if (lk->class == NULL)
+		return;
+	uint64 held = r_time() - lk->acquired_at;
+	struct lock_class_stat *st = &lk->class->stat[cpuid()];
+	if (held > st->hold_max)
+		st->hold_max = held;
+}
+
+// Print the statistics of every lock class taken since the last reset, most spun on first.
+// Or reset them, to profile a window of a workload.
+int lockstat_print(int reset)
+{
+	const uint64 cycles_per_us = CPU_FREQ / 1000000;
+	struct lock_class_stat sum[LOCKSTAT_CLASSES];
+	int order[LOCKSTAT_CLASSES];
+
+	int nr = __atomic_load_n(&nr_lock_classes, __ATOMIC_ACQUIRE);
+	if (reset) {
+		// racy against the counting cpus, a few counts may survive.
+		for (int i = 0; i < nr; i++)
+			memset(lock_classes[i].stat, 0, sizeof(lock_classes[i].stat));
+		return 0;
+	}
+
+	for (int i = 0; i < nr; i++) {
+		memset(&sum[i], 0, sizeof(sum[i]));
+		for (int c = 0; c < NCPU; c++) {
+			struct lock_class_stat *st = &lock_classes[i].stat[c];
+			sum[i].nr_acquire += st->nr_acquire;
+			sum[i].nr_contended += st->nr_contended;
+			sum[i].spin_cycles += st->spin_cycles;
+			sum[i].hold_max = MAX(sum[i].hold_max, st->hold_max);
+		}
+		// insertion sort by spin time, descending.
+		int j;
+		for (j = i; j > 0 && sum[order[j - 1]].spin_cycles < sum[i].spin_cycles; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	printf("lockstat: %d lock classes\n", nr);
+	for (int k = 0; k < nr; k++) {
+		int i = order[k];
+		if (sum[i].nr_acquire == 0)
+			continue;
+		printf("  %s: %d acquired, %d contended, spin %d us, max hold %d us\n", lock_classes[i].name,
+		       (int)sum[i].nr_acquire, (int)sum[i].nr_contended, (int)(sum[i].spin_cycles / cycles_per_us),
+		       (int)(sum[i].hold_max / cycles_per_us));
+	}
+	return 0;
+}
+#else
+static inline uint64 lockstat_start(void)
+{
+	return 0;
+}
+
+static inline void lockstat_acquired(spinlock_t *lk, int contended, uint64 start)
+{
+}
+
+static inline void lockstat_released(spinlock_t *lk)
+{
+}
+
+int lockstat_print(int reset)
+{
+	return -EINVAL;
+}
+#endif
+
 void spinlock_init(spinlock_t *lk, char *name)
 {
 	memset(lk, 0, sizeof(*lk));
 	lk->name = name;
-	lk->locked = 0;
 	lk->cpu = 0;
+#ifdef LOCKSTAT
+	lk->class = lockstat_class(name);
+#endif
+}
+
+void spinlock_init_mcs(spinlock_t *lk, char *name)
+{
+	spinlock_init(lk, name);
+	lk->mcs = 1;
+}
+
+static int is_locked(spinlock_t *lk)
+{
+	if (lk->mcs)
+		return __atomic_load_n(&lk->tail, __ATOMIC_RELAXED) != NULL;
+	return __atomic_load_n(&lk->next, __ATOMIC_RELAXED) != __atomic_load_n(&lk->owner, __ATOMIC_RELAXED);
+}
+
+// Returns whether we had to wait.
+static int ticket_acquire(spinlock_t *lk)
+{
+	// a single amoadd hands out the ticket, then only loads until our turn:
+	// waiters don't fight for the cache line, and are served in order.
+	uint32 ticket = __atomic_fetch_add(&lk->next, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) == ticket)
+		return 0;
+	while (__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != ticket)
+		cpu_relax();
+	return 1;
+}
+
+static void ticket_release(spinlock_t *lk)
+{
+	// only the holder writes owner.
+	__atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+}
+
+// Interrupts are off, so this cpu's nodes are only used by locks it holds or waits for, in any order.
+// Returns whether we had to wait.
+static int mcs_acquire(spinlock_t *lk)
+{
+	struct cpu *c = mycpu();
+	int i;
+	for (i = 0; i < MCS_NODES; i++)
+		if (!(c->mcs_used & (1 << i)))
+			break;
+	if (i == MCS_NODES)
+		panic("out of mcs nodes for %s", lk->name);
+	c->mcs_used |= 1 << i;
+
+	struct mcs_node *node = &c->mcs_nodes[i];
+	node->next = NULL;
+	node->locked = 0;
+	struct mcs_node *prev = __atomic_exchange_n(&lk->tail, node, __ATOMIC_ACQ_REL);
+	if (prev != NULL) {
+		// queue behind prev, and spin on our own node until it hands the lock over.
+		__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+		while (!__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+			cpu_relax();
+	}
+	lk->node = node;
+	return prev != NULL;
+}
+
+static void mcs_release(spinlock_t *lk)
+{
+	struct mcs_node *node = lk->node;
+	struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+	if (next == NULL) {
+		// no one queued yet: free the lock, unless a waiter is joining right now.
+		struct mcs_node *expected = node;
+		if (__atomic_compare_exchange_n(&lk->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			goto out;
+		while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+			cpu_relax();
+	}
+	__atomic_store_n(&next->locked, 1, __ATOMIC_RELEASE);
+out:
+	mycpu()->mcs_used &= ~(1 << (node - mycpu()->mcs_nodes));
 }
 
 // Acquire the lock.
@@ -19,22 +233,17 @@ void acquire(spinlock_t *lk)
 	if (holding(lk))
 		panic("already acquired by %p, now %p", lk->where, ra);
 
-	// On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-	//   a5 = 1
-	//   s1 = &lk->locked
-	//   amoswap.w.aq a5, a5, (s1)
-	while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
-		;
-
-	// Tell the C compiler and the processor to not move loads or stores
-	// past this point, to ensure that the critical section's memory
-	// references happen strictly after the lock is acquired.
-	// On RISC-V, this emits a fence instruction.
-	__sync_synchronize();
+	uint64 start = lockstat_start();
+	int contended;
+	if (lk->mcs)
+		contended = mcs_acquire(lk);
+	else
+		contended = ticket_acquire(lk);
 
 	// Record info about lock acquisition for holding() and debugging.
 	lk->cpu = mycpu();
 	lk->where = (void *)ra;
+	lockstat_acquired(lk, contended, start);
 }
 
 // Release the lock.
@@ -43,25 +252,16 @@ void release(spinlock_t *lk)
 	if (!holding(lk))
 		panic("release");
 
+	lockstat_released(lk);
 	lk->cpu = 0;
 	lk->where = 0;
 
-	// Tell the C compiler and the CPU to not move loads or stores
-	// past this point, to ensure that all the stores in the critical
-	// section are visible to other CPUs before the lock is released,
-	// and that loads in the critical section occur strictly before
-	// the lock is released.
-	// On RISC-V, this emits a fence instruction.
-	__sync_synchronize();
-
-	// Release the lock, equivalent to lk->locked = 0.
-	// This code doesn't use a C assignment, since the C standard
-	// implies that an assignment might be implemented with
-	// multiple store instructions.
-	// On RISC-V, sync_lock_release turns into an atomic swap:
-	//   s1 = &lk->locked
-	//   amoswap.w zero, zero, (s1)
-	__sync_lock_release(&lk->locked);
+	// The release stores order the critical section's loads and stores
+	// before the lock is seen free by the next holder.
+	if (lk->mcs)
+		mcs_release(lk);
+	else
+		ticket_release(lk);
 
 	pop_off();
 }
@@ -71,7 +271,7 @@ void release(spinlock_t *lk)
 int holding(spinlock_t *lk)
 {
 	int r;
-	r = (lk->locked && lk->cpu == mycpu());
+	r = (is_locked(lk) && lk->cpu == mycpu());
 	return r;
 }
 
@@ -110,40 +310,262 @@ void pop_off(void)
 	}
 }
 
-// void initsleeplock(struct sleeplock *lk, char *name)
-// {
-// 	spinlock_init(&lk->lk, "sleep lock");
-// 	lk->name = name;
-// 	lk->locked = 0;
-// 	lk->pid = 0;
-// }
-
-// void acquiresleep(struct sleeplock *lk)
-// {
-// 	acquire(&lk->lk);
-// 	while (lk->locked) {
-// 		sleep(lk, &lk->lk);
-// 	}
-// 	lk->locked = 1;
-// 	lk->pid = myproc()->pid;
-// 	release(&lk->lk);
-// }
-
-// void releasesleep(struct sleeplock *lk)
-// {
-// 	acquire(&lk->lk);
-// 	lk->locked = 0;
-// 	lk->pid = 0;
-// 	wakeup(lk);
-// 	release(&lk->lk);
-// }
-
-// int holdingsleep(struct sleeplock *lk)
-// {
-// 	int r;
-
-// 	acquire(&lk->lk);
-// 	r = lk->locked && (lk->pid == myproc()->pid);
-// 	release(&lk->lk);
-// 	return r;
-// }
+// preempt_disable/preempt_enable keep the current process on this cpu, in the kernel,
+// without disabling interrupts. They nest, and count together with push_off:
+// a process is only preempted when both counts are zero, see preemptible() in sched.c.
+// It must not sleep in between.
+
+void preempt_disable(void)
+{
+	push_off();
+	mycpu()->preempt_count += 1;
+	pop_off();
+}
+
+void preempt_enable(void)
+{
+	push_off();
+	struct cpu *c = mycpu();
+	if (c->preempt_count < 1)
+		panic("preempt_enable - unpair");
+	c->preempt_count -= 1;
+	int resched = c->preempt_count == 0 && c->rq.need_resched;
+	pop_off();
+	// a preemption may have been held off, take it now.
+	if (resched)
+		cond_resched();
+}
+
+#define RW_WRITER  (1U << 31)  // held by a writer
+#define RW_WAITING (1U << 30)  // a writer waits, new readers back off
+
+void rwlock_init(rwlock_t *lk, char *name)
+{
+	memset(lk, 0, sizeof(*lk));
+	lk->name = name;
+}
+
+// Readers only count themselves in, they don't record who they are.
+void read_lock(rwlock_t *lk)
+{
+	push_off();
+	if (lk->cpu == mycpu())
+		panic("read_lock %s: write-locked by this cpu at %p", lk->name, lk->where);
+
+	for (;;) {
+		uint32 cnt = __atomic_load_n(&lk->cnt, __ATOMIC_RELAXED);
+		if (!(cnt & (RW_WRITER | RW_WAITING)) &&
+		    __atomic_compare_exchange_n(&lk->cnt, &cnt, cnt + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		cpu_relax();
+	}
+}
+
+void read_unlock(rwlock_t *lk)
+{
+	uint32 cnt = __atomic_load_n(&lk->cnt, __ATOMIC_RELAXED);
+	if ((cnt & RW_WRITER) || (cnt & ~RW_WAITING) == 0)
+		panic("read_unlock %s", lk->name);
+
+	__atomic_fetch_sub(&lk->cnt, 1, __ATOMIC_RELEASE);
+	pop_off();
+}
+
+void write_lock(rwlock_t *lk)
+{
+	uint64 ra = r_ra();
+	push_off();
+	if (write_holding(lk))
+		panic("already write-locked by %p, now %p", lk->where, ra);
+
+	for (;;) {
+		uint32 cnt = __atomic_load_n(&lk->cnt, __ATOMIC_RELAXED);
+		if ((cnt & ~RW_WAITING) == 0) {
+			// free: take it, which also clears RW_WAITING. other waiting writers set it again.
+			if (__atomic_compare_exchange_n(&lk->cnt, &cnt, RW_WRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				break;
+			continue;
+		}
+		// let the readers drain, and keep new ones out meanwhile.
+		if (!(cnt & RW_WAITING))
+			__atomic_fetch_or(&lk->cnt, RW_WAITING, __ATOMIC_RELAXED);
+		cpu_relax();
+	}
+
+	lk->cpu = mycpu();
+	lk->where = (void *)ra;
+}
+
+void write_unlock(rwlock_t *lk)
+{
+	if (!write_holding(lk))
+		panic("write_unlock %s", lk->name);
+
+	lk->cpu = 0;
+	lk->where = 0;
+	__atomic_store_n(&lk->cnt, 0, __ATOMIC_RELEASE);
+	pop_off();
+}
+
+// Check whether this cpu holds the lock for write.
+int write_holding(rwlock_t *lk)
+{
+	return (__atomic_load_n(&lk->cnt, __ATOMIC_RELAXED) & RW_WRITER) && lk->cpu == mycpu();
+}
+
+// Check whether this cpu holds the lock for write, or anyone holds it for read.
+//  Readers are not recorded, so this is a weaker check than holding(), for assertions.
+int rw_holding(rwlock_t *lk)
+{
+	return write_holding(lk) || (__atomic_load_n(&lk->cnt, __ATOMIC_RELAXED) & ~(RW_WRITER | RW_WAITING));
+}
+
+void seqlock_init(seqlock_t *sl, char *name)
+{
+	sl->seq = 0;
+	spinlock_init(&sl->lock, name);
+}
+
+void write_seqlock(seqlock_t *sl)
+{
+	acquire(&sl->lock);
+	__atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+	// readers that see the update also see seq odd.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void write_sequnlock(seqlock_t *sl)
+{
+	__atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+	release(&sl->lock);
+}
+
+// Start reading: wait for an active writer, and return the sequence to check with read_seqretry().
+//  Never sleeps or disables interrupts, so it can be used anywhere, but not by the writer itself.
+uint32 read_seqbegin(seqlock_t *sl)
+{
+	uint32 seq;
+	while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+		cpu_relax();
+	return seq;
+}
+
+// Whether the data read since read_seqbegin() returned start may be torn, and must be read again.
+int read_seqretry(seqlock_t *sl, uint32 start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+void initsleeplock(struct sleeplock *lk, char *name)
+{
+	spinlock_init(&lk->lk, "sleep lock");
+	lk->name = name;
+	lk->locked = 0;
+	lk->pid = 0;
+}
+
+void acquiresleep(struct sleeplock *lk)
+{
+	acquire(&lk->lk);
+	while (lk->locked) {
+		sleep(lk, &lk->lk);
+	}
+	lk->locked = 1;
+	lk->pid = curr_proc()->pid;
+	release(&lk->lk);
+}
+
+void releasesleep(struct sleeplock *lk)
+{
+	acquire(&lk->lk);
+	lk->locked = 0;
+	lk->pid = 0;
+	wakeup(lk);
+	release(&lk->lk);
+}
+
+int holdingsleep(struct sleeplock *lk)
+{
+	int r;
+
+	acquire(&lk->lk);
+	r = lk->locked && (lk->pid == curr_proc()->pid);
+	release(&lk->lk);
+	return r;
+}
+
+void mutex_init(mutex_t *m, char *name)
+{
+	m->owner = NULL;
+	m->nr_waiters = 0;
+	spinlock_init(&m->lk, "mutex");
+	m->name = name;
+}
+
+static int mutex_trylock_proc(mutex_t *m, struct proc *p)
+{
+	struct proc *expected = NULL;
+	return __atomic_compare_exchange_n(&m->owner, &expected, p, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+int mutex_trylock(mutex_t *m)
+{
+	return mutex_trylock_proc(m, curr_proc());
+}
+
+// Spin while the owner of m is running, on another hart since we run here.
+// Returns 1 once m is free, or 0 if we had better sleep:
+// the owner went to sleep or was switched out, or someone else should have our cpu.
+static int mutex_spin_on_owner(mutex_t *m)
+{
+	struct proc *owner;
+	// struct proc is never freed, so a stale owner is only read a few times, until m->owner changes.
+	while ((owner = __atomic_load_n(&m->owner, __ATOMIC_RELAXED)) != NULL) {
+		if (owner->state != RUNNING || need_resched())
+			return 0;
+		cpu_relax();
+	}
+	return 1;
+}
+
+void mutex_lock(mutex_t *m)
+{
+	struct proc *p = curr_proc();
+	if (m->owner == p)
+		panic("mutex %s: already locked", m->name);
+
+	for (;;) {
+		if (mutex_trylock_proc(m, p))
+			return;
+		if (mutex_spin_on_owner(m))
+			continue;
+
+		acquire(&m->lk);
+		// paired with mutex_unlock(), which clears owner and then checks nr_waiters:
+		// either it sees us and wakes us up under m->lk, or we see m free.
+		__atomic_fetch_add(&m->nr_waiters, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&m->owner, __ATOMIC_SEQ_CST) != NULL)
+			sleep(m, &m->lk);
+		__atomic_fetch_sub(&m->nr_waiters, 1, __ATOMIC_RELAXED);
+		release(&m->lk);
+	}
+}
+
+void mutex_unlock(mutex_t *m)
+{
+	if (m->owner != curr_proc())
+		panic("mutex_unlock %s", m->name);
+
+	__atomic_store_n(&m->owner, NULL, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&m->nr_waiters, __ATOMIC_SEQ_CST)) {
+		acquire(&m->lk);
+		wakeup(m);
+		release(&m->lk);
+	}
+}
+
+int mutex_holding(mutex_t *m)
+{
+	return __atomic_load_n(&m->owner, __ATOMIC_RELAXED) == curr_proc();
+}
@@ -3,14 +3,37 @@
 
 #include "types.h"
 
+// A waiter in the queue of an MCS lock. Every cpu has MCS_NODES of them, see struct cpu.
+struct mcs_node {
+    struct mcs_node *next;  // the waiter after us
+    int locked;             // set by our predecessor, when it hands us the lock
+};
+
+#define MCS_NODES (4)  // MCS locks a cpu may hold or wait for at once
+
+struct lock_class;
+
 // Mutual exclusion lock.
+//  A ticket lock by default: acquirers take the next ticket and wait for their turn, so they are served in order.
+//  spinlock_init_mcs() makes it an MCS queue lock: each waiter spins on its own node instead of the shared lock,
+//  which keeps the lock's cache line quiet under heavy contention.
+//  A zeroed spinlock is an unlocked ticket lock.
 struct spinlock {
-    uint64 locked;  // Is the lock held?, use AMO instructions to access this field.
+    uint32 next;            // ticket lock: the next ticket to hand out
+    uint32 owner;           // ticket lock: the ticket being served
+    struct mcs_node *tail;  // MCS lock: the last waiter, or the holder if none, NULL if free
+    struct mcs_node *node;  // MCS lock: the holder's node
+    int mcs;                // is an MCS lock
 
     // For debugging:
     char *name;       // Name of lock.
     struct cpu *cpu;  // The cpu holding the lock.
     void *where;      // who calls acquire?
+
+#ifdef LOCKSTAT
+    struct lock_class *class;  // statistics of all locks named alike, NULL if not spinlock_init()-ed
+    uint64 acquired_at;        // r_time() when the holder got it
+#endif
 };
 
 // Long-term locks for processes
@@ -23,14 +46,79 @@ struct sleeplock {
     int pid;     // Process holding lock
 };
 
+// Adaptive mutex, for long critical sections in process context.
+//  An acquirer spins while the owner is running on another hart, as it is likely to unlock soon,
+//  and sleeps once the owner sleeps or is switched out. The owner may sleep and be preempted.
+//  Must not be taken in an interrupt handler, or while holding a spinlock.
+struct mutex {
+    struct proc *owner;  // NULL if free
+    int nr_waiters;      // processes going to sleep or sleeping on the mutex
+    struct spinlock lk;  // orders the sleepers against mutex_unlock()
+
+    // For debugging:
+    char *name;  // Name of lock.
+};
+
+// Reader-writer spinlock: any number of readers, or a single writer. For data that is mostly read.
+//  A waiting writer holds off new readers, so a stream of readers cannot starve it.
+//  Thus a reader must not take the same lock again, it would wait for a writer waiting for it.
+struct rwlock {
+    uint32 cnt;  // readers holding the lock, or RW_WRITER; RW_WAITING is set while a writer waits
+
+    // For debugging:
+    char *name;       // Name of lock.
+    struct cpu *cpu;  // The cpu holding the lock for write.
+    void *where;      // who calls write_lock?
+};
+
+// Sequence lock, for small data read far more often than written.
+//  Writers are serialized by lock, and make seq odd during their update.
+//  Readers write nothing: they copy the data, and retry if a writer was active meanwhile.
+struct seqlock {
+    uint32 seq;
+    struct spinlock lock;
+};
+
 typedef struct spinlock spinlock_t;
 typedef struct sleeplock sleeplock_t;
+typedef struct mutex mutex_t;
+typedef struct rwlock rwlock_t;
+typedef struct seqlock seqlock_t;
 
 void spinlock_init(struct spinlock *lk, char *name);
+void spinlock_init_mcs(struct spinlock *lk, char *name);
 void acquire(struct spinlock *lk);
 void release(struct spinlock *lk);
 int holding(struct spinlock *lk);
 void push_off(void);
 void pop_off(void);
+void preempt_disable(void);
+void preempt_enable(void);
+int lockstat_print(int reset);
+
+void initsleeplock(struct sleeplock *lk, char *name);
+void acquiresleep(struct sleeplock *lk);
+void releasesleep(struct sleeplock *lk);
+int holdingsleep(struct sleeplock *lk);
+
+void mutex_init(struct mutex *m, char *name);
+void mutex_lock(struct mutex *m);
+int mutex_trylock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+int mutex_holding(struct mutex *m);
+
+void rwlock_init(struct rwlock *lk, char *name);
+void read_lock(struct rwlock *lk);
+void read_unlock(struct rwlock *lk);
+void write_lock(struct rwlock *lk);
+void write_unlock(struct rwlock *lk);
+int write_holding(struct rwlock *lk);
+int rw_holding(struct rwlock *lk);
+
+void seqlock_init(struct seqlock *sl, char *name);
+void write_seqlock(struct seqlock *sl);
+void write_sequnlock(struct seqlock *sl);
+uint32 read_seqbegin(struct seqlock *sl);
+int read_seqretry(struct seqlock *sl, uint32 start);
 
 #endif  //  __LOCK_H__
\ No newline at end of file
@@ -1,12 +1,14 @@
 #include "console.h"
 #include "debug.h"
 #include "defs.h"
+#include "futex.h"
 #include "kalloc.h"
 #include "loader.h"
 #include "plic.h"
 #include "proc.h"
 #include "sbi.h"
 #include "timer.h"
+#include "workqueue.h"
 
 uint64 __pa kernel_image_end_4k;
 uint64 __pa kernel_image_end_2M;
@@ -194,7 +196,8 @@ static void bootcpu_init() {
                 printf("skipped for hart %d\n", hartid);
                 continue;
             }
-            while (booted_count == saved_booted_cnt);
+            while (booted_count == saved_booted_cnt)
+                cpu_relax();
             cpuid++;
         }
         printf("System has %d cpus online\n\n", cpuid);
@@ -213,12 +216,17 @@ static void bootcpu_init() {
     kpgmgrinit();
     uvm_init();
     proc_init();
+    futex_init();
+    workqueue_init();
+    rcu_init();
     allocator_init(&kstrbuf, "kstrbuf", KSTRING_MAX, 4096);
     loader_init();
     load_init_app();
 
     timer_init();
     plicinithart();
+    // after load_init_app(), so that init gets pid 1.
+    workqueue_start();
 
     MEMORY_FENCE();
     halt_specific_init = 1;
@@ -233,11 +241,13 @@ static void bootcpu_init() {
 static void secondarycpu_init() {
     printf("cpu %d (halt %d) booted. sp: %p\n", mycpu()->cpuid, mycpu()->mhart_id, r_sp());
     booted_count++;
-    while (!halt_specific_init);
+    while (!halt_specific_init)
+        cpu_relax();
 
     trap_init();
     timer_init();
     plicinithart();
+    workqueue_start();
 
     infof("start scheduler!");
     scheduler();
@@ -69,7 +69,10 @@
 #define USER_TOP   (MAXVA)
 #define TRAMPOLINE (USER_TOP - PGSIZE)
 #define TRAPFRAME  (TRAMPOLINE - PGSIZE)
-#define MAX_USERVA (TRAPFRAME - 1)
+// each process maps its trapframe at its own VA below TRAMPOLINE,
+//  so that processes sharing an mm (vfork) don't overwrite each other's.
+#define TRAPFRAME_VA(index) (TRAPFRAME - (uint64)(index) * PGSIZE)
+#define MAX_USERVA          (TRAPFRAME_VA(NPROC - 1) - 1)
 
 
 #endif  // MEMLAYOUT_H
\ No newline at end of file
@@ -12,7 +12,8 @@ static uint64 kernelprint_lock = 0;
 
 // Kernel's output should be prioritized.
 void acquire_kprint(void) {
-    while (__sync_lock_test_and_set(&kernelprint_lock, 1) != 0);
+    while (__sync_lock_test_and_set(&kernelprint_lock, 1) != 0)
+        cpu_relax();
     __sync_synchronize();
 }
 
@@ -5,13 +5,28 @@
 #include "loader.h"
 #include "queue.h"
 #include "trap.h"
+#include "waitqueue.h"
 
 struct proc *pool[NPROC];
 struct proc *init_proc = NULL;
 static allocator_t proc_allocator;
 
-static spinlock_t pid_lock;
-static spinlock_t wait_lock;
+// pid allocator: a bitmap of in-use pids, claimed with AMOs.
+//  Allocation starts after the last allocated pid and wraps around,
+//  so a pid is not reused immediately after its owner is freed.
+static uint64 pidmap[PID_MAX / 64];
+static int last_pid;
+
+// pid -> struct proc hash table.
+//  allocproc() inserts and freeproc() removes, both with p->lock held.
+//  Lock order: p->lock -> bucket lock. Lookups take no lock, they walk the chains under RCU:
+//  a removed proc keeps its pid_next, and is only reused, and relinked elsewhere, after a grace period.
+static struct {
+    spinlock_t lock;
+    struct proc *head;
+} pidhash[PIDHASH_SIZE];
+
+#define PIDHASH(pid) ((uint64)(pid) & (PIDHASH_SIZE - 1))
 
 extern void sched_init();
 
@@ -22,8 +37,14 @@ void proc_init() {
     assert(proc_inited == 0);
     proc_inited = 1;
 
-    spinlock_init(&pid_lock, "pid");
-    spinlock_init(&wait_lock, "wait");
+    // pid 0 is never allocated.
+    pidmap[0] = 1;
+    for (int i = 0; i < PIDHASH_SIZE; i++) {
+        spinlock_init(&pidhash[i].lock, "pidhash");
+        pidhash[i].head = NULL;
+    }
+
+    waitqueue_init();
 
     allocator_init(&proc_allocator, "proc", sizeof(struct proc), NPROC);
     struct proc *p;
@@ -34,6 +55,10 @@ void proc_init() {
         p = kalloc(&proc_allocator);
         memset(p, 0, sizeof(*p));
         spinlock_init(&p->lock, "proc");
+        spinlock_init(&p->child_lock, "child");
+        list_init(&p->children);
+        list_init(&p->sibling);
+        list_init(&p->wq_link);
         p->index = i;
         p->state = UNUSED;
 
@@ -58,48 +83,161 @@ void proc_init() {
 }
 
 static int allocpid() {
-    static int PID = 1;
-    int retpid     = -1;
+    int start = __atomic_load_n(&last_pid, __ATOMIC_RELAXED) + 1;
+
+    // scan at most PID_MAX bits, starting from the word holding `start`.
+    for (int n = 0; n <= PID_MAX / 64; n++) {
+        int pid = (start + n * 64) % PID_MAX;
+        // only the first word is scanned from the middle.
+        if (n > 0)
+            pid &= ~63;
+        uint64 *word = &pidmap[pid / 64];
+        for (;;) {
+            uint64 val  = __atomic_load_n(word, __ATOMIC_RELAXED);
+            uint64 free = ~val & (~0ull << (pid % 64));
+            if (free == 0)
+                break;
+            int bit     = __builtin_ctzl(free);
+            uint64 mask = 1ull << bit;
+            if ((__atomic_fetch_or(word, mask, __ATOMIC_ACQUIRE) & mask) == 0) {
+                pid = (pid & ~63) + bit;
+                __atomic_store_n(&last_pid, pid, __ATOMIC_RELAXED);
+                return pid;
+            }
+            // lost the race for this bit, retry the same word.
+        }
+    }
+    return -1;
+}
 
-    acquire(&pid_lock);
-    retpid = PID++;
-    release(&pid_lock);
+static void freepid(int pid) {
+    assert(pid > 0 && pid < PID_MAX);
+    uint64 mask = 1ull << (pid % 64);
+    uint64 old  = __atomic_fetch_and(&pidmap[pid / 64], ~mask, __ATOMIC_RELEASE);
+    assert(old & mask);
+}
 
-    return retpid;
+static void pidhash_insert(struct proc *p) {
+    assert(holding(&p->lock));
+    int h = PIDHASH(p->pid);
+    acquire(&pidhash[h].lock);
+    p->pid_next = pidhash[h].head;
+    // lookups see p's fields once they see p.
+    __atomic_store_n(&pidhash[h].head, p, __ATOMIC_RELEASE);
+    release(&pidhash[h].lock);
 }
+
+static void pidhash_remove(struct proc *p) {
+    assert(holding(&p->lock));
+    int h = PIDHASH(p->pid);
+    acquire(&pidhash[h].lock);
+    struct proc **pp = &pidhash[h].head;
+    while (*pp != p) {
+        assert(*pp != NULL);
+        pp = &(*pp)->pid_next;
+    }
+    // lookups standing on p may still follow its pid_next.
+    __atomic_store_n(pp, p->pid_next, __ATOMIC_RELEASE);
+    release(&pidhash[h].lock);
+}
+
+// Find the process with the given pid.
+// Returns with p->lock held, or NULL if there is no such process.
+struct proc *pid_lookup(int pid) {
+    struct proc *p;
+    if (pid <= 0 || pid >= PID_MAX)
+        return NULL;
+
+    int h = PIDHASH(pid);
+    rcu_read_lock();
+    for (p = __atomic_load_n(&pidhash[h].head, __ATOMIC_ACQUIRE); p != NULL;
+         p = __atomic_load_n(&p->pid_next, __ATOMIC_ACQUIRE)) {
+        if (p->pid == pid)
+            break;
+    }
+    rcu_read_unlock();
+
+    if (p == NULL)
+        return NULL;
+
+    // struct proc is never freed, so it's safe to lock it after leaving the read-side section.
+    //  But it may have been freed and reused in between, check again.
+    acquire(&p->lock);
+    if (p->pid != pid || p->state == UNUSED) {
+        release(&p->lock);
+        return NULL;
+    }
+    return p;
+}
+
 static void first_sched_ret(void) {
+    finish_switch();
     release(&curr_proc()->lock);
     intr_off();
     usertrapret();
 }
 
+// A kernel thread starts here instead: it never returns to user space.
+static void kthread_ret(void) {
+    finish_switch();
+    struct proc *p = curr_proc();
+    release(&p->lock);
+    intr_on();
+    p->kthread_fn(p->kthread_arg);
+    panic("kthread %d returned", p->pid);
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel.
 // If there are no free procs, or a memory allocation fails, return 0.
+//  Waits for the grace period of the FREEING procs rather than failing, so it must be called without any lock.
 struct proc *allocproc() {
     struct proc *p;
-    for (int i = 0; i < NPROC; i++) {
-        p = pool[i];
-        acquire(&p->lock);
-        if (p->state == UNUSED) {
-            goto found;
+    for (;;) {
+        int freeing = 0;
+        for (int i = 0; i < NPROC; i++) {
+            p = pool[i];
+            // racy read, only lock the candidates.
+            if (p->state == FREEING)
+                freeing = 1;
+            if (p->state != UNUSED)
+                continue;
+            acquire(&p->lock);
+            if (p->state == UNUSED) {
+                goto found;
+            }
+            release(&p->lock);
         }
-        release(&p->lock);
+        if (!freeing)
+            return 0;
+        // under fork/exit churn, the table may be full of procs only waiting for freeproc_rcu().
+        rcu_barrier();
     }
-    return 0;
 
 found:
     // initialize a proc
     tracef("init proc %p", p);
-    p->parent     = NULL;
-    p->exit_code  = 0;
-    p->sleep_chan = NULL;
-    p->pid        = allocpid();
-    p->state      = USED;
+    p->pid = allocpid();
+    if (p->pid < 0) {
+        release(&p->lock);
+        return 0;
+    }
+    p->parent       = NULL;
+    p->vfork_parent = NULL;
+    p->exit_code    = 0;
+    p->sleep_chan   = NULL;
+    p->last_cpu     = -1;
+    p->nice         = 0;
+    p->wakeup_time  = 0;
+    p->kthread_fn   = NULL;
+    p->kthread_arg  = NULL;
+    p->state        = USED;
+    sched_fork(p);
+    fpu_reset(p);
+    pidhash_insert(p);
 
     // fork or exec(load_user_elf) will initialize these:
-    p->mm      = NULL;
-    p->vma_brk = NULL;
+    p->mm = NULL;
 
     // prepare trapframe and the first return context.
     memset(&p->context, 0, sizeof(p->context));
@@ -113,65 +251,52 @@ found:
     return p;
 }
 
+// The grace period after freeproc() is over: no pid lookup still stands on p.
+static void freeproc_rcu(struct rcu_head *head) {
+    struct proc *p = container_of(head, struct proc, rcu);
+    acquire(&p->lock);
+    p->state = UNUSED;
+    release(&p->lock);
+}
+
 static void freeproc(struct proc *p) {
     assert(holding(&p->lock));
 
-    p->state      = UNUSED;
+    pidhash_remove(p);
+    freepid(p->pid);
+
+    // not UNUSED until the grace period is over, so that allocproc() doesn't relink p meanwhile.
+    p->state      = FREEING;
     p->pid        = -1;
     p->exit_code  = 0xdeadbeef;
     p->sleep_chan = NULL;
     p->killed     = 0;
     p->parent     = NULL;
 
+    // exit() has already released the mm, only fork()'s error path gets here with one.
     if (p->mm) {
-        assert(!holding(&p->mm->lock));
-        acquire(&p->mm->lock);
-        mm_free(p->mm);
+        assert(!write_holding(&p->mm->lock));
+        write_lock(&p->mm->lock);
+        mm_put(p->mm, TRAPFRAME_VA(p->index));
     }
 
-    p->mm      = NULL;
-    p->vma_brk = NULL;
+    p->mm = NULL;
+    call_rcu(&p->rcu, freeproc_rcu);
 }
 
-void sleep(void *chan, spinlock_t *lk) {
-    struct proc *p = curr_proc();
-
-    // Must acquire p->lock in order to
-    // change p->state and then call sched.
-    // Once we hold p->lock, we can be
-    // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
-    // so it's okay to release lk.
-
-    acquire(&p->lock);  // DOC: sleeplock1
-    release(lk);
+// Link np into p's children and let it run.
+//  Caller holds p->child_lock, respecting the child_lock -> p->lock order. Returns np's pid.
+static int start_child(struct proc *p, struct proc *np) {
+    assert(holding(&p->child_lock));
 
-    // Go to sleep.
-    p->sleep_chan = chan;
-    p->state      = SLEEPING;
-
-    sched();
-
-    // p get waking up, Tidy up.
-    p->sleep_chan = 0;
-
-    // Reacquire original lock.
-    release(&p->lock);
-    acquire(lk);
-}
-
-// Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
-void wakeup(void *chan) {
-    for (int i = 0; i < NPROC; i++) {
-        struct proc *p = pool[i];
-        acquire(&p->lock);
-        if (p->state == SLEEPING && p->sleep_chan == chan) {
-            p->state = RUNNABLE;
-            add_task(p);
-        }
-        release(&p->lock);
-    }
+    acquire(&np->lock);
+    np->parent = p;
+    list_add(&np->sibling, &p->children);
+    np->state = RUNNABLE;
+    add_task(np);
+    int pid = np->pid;
+    release(&np->lock);
+    return pid;
 }
 
 int fork() {
@@ -181,7 +306,7 @@ int fork() {
     if (np == NULL) {
         return -ENOMEM;
     }
-    np->mm = mm_create(np->trapframe);
+    np->mm = mm_create(np->trapframe, TRAPFRAME_VA(np->index));
     if (np->mm == NULL) {
         freeproc(np);
         release(&np->lock);
@@ -192,34 +317,40 @@ int fork() {
 
     struct proc *p = curr_proc();
     acquire(&p->lock);
-    acquire(&p->mm->lock);
+    read_lock(&p->mm->lock);
 
     // Copy user memory from parent to child.
     if ((ret = mm_copy(p->mm, np->mm)) < 0)
         goto err_free;
     // Set np's vma_brk
-    np->vma_brk = mm_find_vma(np->mm, p->vma_brk->vm_start);
-    np->brk     = p->brk;
+    np->mm->vma_brk = mm_find_vma(np->mm, p->mm->vma_brk->vm_start);
+    np->mm->brk     = p->mm->brk;
 
-    release(&p->mm->lock);
-    release(&np->mm->lock);
+    read_unlock(&p->mm->lock);
+    write_unlock(&np->mm->lock);
 
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
 
     // Cause fork to return 0 in the child.
     np->trapframe->a0 = 0;
-    np->parent        = p;
-    np->state         = RUNNABLE;
-    add_task(np);
+    fpu_fork(p, np);
+
+    // the child inherits our nice value and cpu affinity.
+    sched_setnice(np, p->nice);
+    np->cpus_allowed = p->cpus_allowed;
     release(&np->lock);
     release(&p->lock);
 
-    return np->pid;
+    acquire(&p->child_lock);
+    ret = start_child(p, np);
+    release(&p->child_lock);
+
+    return ret;
 
 err_free:
-    release(&np->mm->lock);
-    release(&p->mm->lock);
+    write_unlock(&np->mm->lock);
+    read_unlock(&p->mm->lock);
     release(&p->lock);
 
     freeproc(np);
@@ -227,6 +358,145 @@ err_free:
     return ret;
 }
 
+// Allocate a child of p sharing p's mm, with a copy of p's user registers, for vfork() and clone().
+//  Returns with np->lock and p->lock held, or NULL.
+static struct proc *alloc_mm_sharer(struct proc *p) {
+    struct proc *np = allocproc();
+    if (np == NULL)
+        return NULL;
+
+    acquire(&p->lock);
+    write_lock(&p->mm->lock);
+    if (mm_map_trapframe(p->mm, np->trapframe, TRAPFRAME_VA(np->index)) < 0) {
+        write_unlock(&p->mm->lock);
+        release(&p->lock);
+        freeproc(np);
+        release(&np->lock);
+        return NULL;
+    }
+    p->mm->refcnt++;
+    write_unlock(&p->mm->lock);
+    np->mm = p->mm;
+
+    *(np->trapframe) = *(p->trapframe);
+    fpu_fork(p, np);
+    sched_setnice(np, p->nice);
+    np->cpus_allowed = p->cpus_allowed;
+    return np;
+}
+
+// Like fork(), but the child borrows our mm instead of copying it,
+//  and we are suspended until the child calls exec() or exit().
+//  The child must not return from the function that called vfork(), as it runs on our stack.
+int vfork() {
+    int ret;
+    struct proc *p  = curr_proc();
+    struct proc *np = alloc_mm_sharer(p);
+    if (np == NULL)
+        return -ENOMEM;
+
+    np->trapframe->a0 = 0;
+    np->vfork_parent  = p;
+    release(&np->lock);
+    release(&p->lock);
+
+    acquire(&p->child_lock);
+    ret = start_child(p, np);
+    // np cannot be reaped before we get here, as only we wait() for it.
+    while (np->vfork_parent == p)
+        sleep(&np->vfork_parent, &p->child_lock);
+    release(&p->child_lock);
+
+    return ret;
+}
+
+// Create a thread: a child process sharing our mm, which starts at entry(arg) on the user stack `stack`, with tp = tls.
+//  Threads are joined with wait(), like any child. Returns the child's pid.
+int clone(uint64 entry, uint64 arg, uint64 stack, uint64 tls) {
+    int ret;
+    struct proc *p  = curr_proc();
+    struct proc *np = alloc_mm_sharer(p);
+    if (np == NULL)
+        return -ENOMEM;
+
+    np->trapframe->epc = entry;
+    np->trapframe->a0  = arg;
+    np->trapframe->sp  = stack;
+    np->trapframe->tp  = tls;
+    release(&np->lock);
+    release(&p->lock);
+
+    acquire(&p->child_lock);
+    ret = start_child(p, np);
+    release(&p->child_lock);
+
+    return ret;
+}
+
+// p no longer uses the mm of its vfork() parent, let the parent continue.
+static void vfork_release(struct proc *p) {
+    struct proc *parent = p->vfork_parent;
+    if (parent == NULL)
+        return;
+
+    acquire(&parent->child_lock);
+    p->vfork_parent = NULL;
+    wakeup(&p->vfork_parent);
+    release(&parent->child_lock);
+}
+
+// Create a child process running the program `name`, without copying our address space.
+//  Returns the child's pid.
+int spawn(char *name, char *args[]) {
+    struct user_app *app = get_elf(name);
+    if (app == NULL)
+        return -ENOENT;
+
+    int ret;
+    struct proc *p  = curr_proc();
+    struct proc *np = allocproc();
+    if (np == NULL)
+        return -ENOMEM;
+    // np is USED, no one else touches it until start_child().
+    release(&np->lock);
+
+    ret = load_user_elf(app, np, args);
+    acquire(&np->lock);
+    if (ret < 0) {
+        freeproc(np);
+        release(&np->lock);
+        return ret;
+    }
+    // racy reads of p's scheduling parameters, as we must not take p->lock while holding np->lock.
+    sched_setnice(np, p->nice);
+    np->cpus_allowed = p->cpus_allowed;
+    release(&np->lock);
+
+    acquire(&p->child_lock);
+    ret = start_child(p, np);
+    release(&p->child_lock);
+
+    return ret;
+}
+
+// Create a kernel thread running fn(arg) on its own kernel stack, on one of the cpus in `cpus`.
+//  It has no mm and no parent, and is scheduled like any process. fn must never return.
+//  Returns the new thread, already RUNNABLE, or NULL.
+struct proc *kthread_create(void (*fn)(void *), void *arg, uint64 cpus) {
+    struct proc *p = allocproc();
+    if (p == NULL)
+        return NULL;
+
+    p->kthread_fn   = fn;
+    p->kthread_arg  = arg;
+    p->cpus_allowed = cpus;
+    p->context.ra   = (uint64)kthread_ret;
+    p->state        = RUNNABLE;
+    add_task(p);
+    release(&p->lock);
+    return p;
+}
+
 int exec(char *name, char *args[]) {
     struct user_app *app = get_elf(name);
     if (app == NULL)
@@ -235,111 +505,152 @@ int exec(char *name, char *args[]) {
     int ret;
     struct proc *p = curr_proc();
 
-    acquire(&p->lock);
-
     // execve does NOT preserve memory mappings:
     //  free VMAs including program_brk, and ustack
     // load_user_elf() will create a new mm for the new process and free the old one
     //  , if page allocations all succeed.
     // Otherwise, we will return to the old process.
     // However, keep the phys page of trapframe, because it belongs to struct proc.
-    if ((ret = load_user_elf(app, p, args)) < 0) {
-        release(&p->lock);
+    if ((ret = load_user_elf(app, p, args)) < 0)
         return ret;
-    }
+    fpu_reset(p);
 
-    release(&p->lock);
+    // we have left the mm of our vfork() parent.
+    vfork_release(p);
 
     // syscall() will overwrite trapframe->a0 to the return value.
     return p->trapframe->a0;
 }
 
+// Reap a ZOMBIE child: report its exit code and free it.
+// Called with p->child_lock and child->lock held, releases child->lock.
+static int reap(struct proc *p, struct proc *child, int __user *code) {
+    int cpid = child->pid;
+    if (code) {
+        read_lock(&p->mm->lock);
+        int exit_code = child->exit_code;
+        copy_to_user(p->mm, (uint64)code, (char *)&exit_code, sizeof(int));
+        read_unlock(&p->mm->lock);
+    }
+    list_del(&child->sibling);
+    freeproc(child);
+    release(&child->lock);
+    return cpid;
+}
+
 int wait(int pid, int __user *code) {
     struct proc *child;
     int havekids;
     struct proc *p = curr_proc();
 
-    acquire(&wait_lock);
+    acquire(&p->child_lock);
 
     for (;;) {
-        // Scan through table looking for exited children.
         havekids = 0;
-        for (int i = 0; i < NPROC; i++) {
-            child = pool[i];
-            if (child == p)
-                continue;
-
-            acquire(&child->lock);
-            if (child->parent == p) {
-                havekids = 1;
-                if (child->state == ZOMBIE && (pid <= 0 || child->pid == pid)) {
-                    int cpid = child->pid;
-                    // Found one.
-                    if (code) {
-                        acquire(&p->mm->lock);
-                        int exit_code = child->exit_code;
-                        copy_to_user(p->mm, (uint64)code, (char*)&exit_code, sizeof(int));
-                        release(&p->mm->lock);
+        if (pid > 0) {
+            // Waiting for a specific child: look it up directly.
+            child = pid_lookup(pid);
+            if (child != NULL) {
+                // child->parent is stable because we hold p->child_lock.
+                if (child->parent == p) {
+                    havekids = 1;
+                    if (child->state == ZOMBIE) {
+                        int cpid = reap(p, child, code);
+                        release(&p->child_lock);
+                        return cpid;
                     }
-                    freeproc(child);
-                    release(&child->lock);
-                    release(&wait_lock);
+                }
+                release(&child->lock);
+            }
+        } else {
+            // Scan through our children looking for exited ones.
+            list_for_each_entry(child, &p->children, sibling) {
+                havekids = 1;
+                acquire(&child->lock);
+                if (child->state == ZOMBIE) {
+                    int cpid = reap(p, child, code);
+                    release(&p->child_lock);
                     return cpid;
                 }
+                release(&child->lock);
             }
-            release(&child->lock);
         }
 
         // No waiting if we don't have any children.
         if (!havekids || p->killed) {
-            release(&wait_lock);
+            release(&p->child_lock);
             return -ECHILD;
         }
 
         debugf("pid %d sleeps for wait", p->pid);
         // Wait for a child to exit.
-        sleep(p, &wait_lock);  // DOC: wait-sleep
+        sleep(p, &p->child_lock);  // DOC: wait-sleep
+    }
+}
+
+// Lock the parent's child_lock of p.
+// p->parent may change under us (reparenting), so check it again after locking.
+static struct proc *lock_parent(struct proc *p) {
+    for (;;) {
+        struct proc *parent = __atomic_load_n(&p->parent, __ATOMIC_ACQUIRE);
+        acquire(&parent->child_lock);
+        if (p->parent == parent)
+            return parent;
+        release(&parent->child_lock);
     }
 }
 
 // Exit the current process.
 void exit(int code) {
     struct proc *p = curr_proc();
+    struct proc *child, *tmp;
 
     if (p == init_proc) {
         panic("init process exited");
     }
+    assert(p->kthread_fn == NULL);
 
-    acquire(&wait_lock);
-
-    int wakeinit = 0;
-
-    // reparent:
-    for (int i = 0; i < NPROC; i++) {
-        struct proc *child = pool[i];
-        if (child == p)
-            continue;
-        acquire(&child->lock);
-        if (child->parent == p) {
+    // release the address space now, instead of leaving it to freeproc() in the parent's wait().
+    //  A ZOMBIE only keeps its struct proc (with its trapframe and kstack) for the parent to collect.
+    //  We are running on the kernel pagetable, so it's safe to free the user pagetable here.
+    acquire(&p->lock);
+    struct mm *mm = p->mm;
+    p->mm         = NULL;
+    release(&p->lock);
+    if (mm) {
+        write_lock(&mm->lock);
+        mm_put(mm, TRAPFRAME_VA(p->index));
+    }
+    vfork_release(p);
+    sched_exit(p);
+
+    // reparent our children to init.
+    //  No new children can appear, because only we can fork them.
+    acquire(&p->child_lock);
+    if (!list_empty(&p->children)) {
+        acquire(&init_proc->child_lock);
+        list_for_each_entry_safe(child, tmp, &p->children, sibling) {
+            list_del(&child->sibling);
             child->parent = init_proc;
-            wakeinit      = 1;
-            // if child has dead, wake up init to do clean up.
+            list_add_tail(&child->sibling, &init_proc->children);
         }
-        release(&child->lock);
-    }
-    if (wakeinit)
+        // if any child has dead, wake up init to do clean up.
         wakeup(init_proc);
+        release(&init_proc->child_lock);
+    }
+    release(&p->child_lock);
 
     // wakeup wait-ing parent.
-    //  There is no race because locking against "wait_lock"
-    wakeup(p->parent);
+    //  There is no race because the parent checks our state under parent->child_lock.
+    struct proc *parent = lock_parent(p);
+    wakeup(parent);
 
     acquire(&p->lock);
 
     p->exit_code = code;
     p->state     = ZOMBIE;
 
-    release(&wait_lock);
+    release(&parent->child_lock);
 
     sched();
     panic_never_reach();
@@ -349,24 +660,24 @@ void exit(int code) {
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
 int kill(int pid) {
-    struct proc *p;
-
-    for (int i = 0; i < NPROC; i++) {
-        p = pool[i];
-        acquire(&p->lock);
-        if (p->pid == pid) {
-            p->killed = -1;
-            if (p->state == SLEEPING) {
-                // Wake process from sleep().
-                p->state = RUNNABLE;
-                add_task(p);
-            }
-            release(&p->lock);
-            return 0;
-        }
+    struct proc *p = pid_lookup(pid);
+    if (p == NULL)
+        return -EINVAL;
+    // kernel threads never check p->killed.
+    if (p->kthread_fn != NULL) {
         release(&p->lock);
+        return -EINVAL;
+    }
+
+    p->killed = -1;
+    if (p->state == SLEEPING) {
+        // Wake process from sleep().
+        p->state       = RUNNABLE;
+        p->wakeup_time = r_time();
+        add_task(p);
     }
-    return -EINVAL;
+    release(&p->lock);
+    return 0;
 }
 
 void setkilled(struct proc *p, int reason) {
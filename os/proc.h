@@ -1,8 +1,11 @@
 #ifndef PROC_H
 #define PROC_H
 
-#include "queue.h"
+#include "fpu.h"
+#include "list.h"
+#include "rcu.h"
 #include "riscv.h"
+#include "sched.h"
 #include "vm.h"
 
 enum {
@@ -31,18 +34,45 @@ struct context {
     uint64 s11;
 };
 
+#define LAT_HIST_BUCKETS (16)
+
 struct cpu {
     int mhart_id;                  // mhartid for this cpu, passed by OpenSBI
     struct proc *proc;             // current process
     struct context sched_context;  // scheduler context, swtch() here to run scheduler
     int inkernel_trap;             // whether we are in a kernel trap context
     int noff;                      // how many push-off
+    int preempt_count;             // how many preempt_disable(), the process in the kernel is not preempted unless 0
     int interrupt_on;              // Is the interrupt Enabled before the first push-off?
     uint64 sched_kstack_top;       // top of per-cpu sheduler kernel stack
     int cpuid;                     // for debug purpose
+    int online;                    // whether this cpu has entered the scheduler
+    struct proc *prev;             // the process that just switched away, its p->lock is released by finish_switch()
+    struct proc *fp_owner;         // whose FP state is in the FP registers, see fpu.c
+    int tick_stopped;              // isolated, and running a single process without the tick. protected by rq->lock
+    struct mcs_node mcs_nodes[MCS_NODES];  // queue nodes for the MCS locks we hold or wait for, see lock.c
+    int mcs_used;                          // bit i set if mcs_nodes[i] is in use
+    uint64 rcu_seq;                        // quiescent states, odd in user mode or idle, see rcu.c
+
+    // idle statistics
+    uint64 idle_cycles;    // time spent in wfi
+    uint64 nr_idle;        // times entered wfi
+    uint64 nr_spurious;    // wakeups from wfi that found nothing to run
+    uint64 nr_timer_intr;  // timer interrupts taken
+    uint64 nr_ipi;         // IPIs received
+    uint64 nr_migrations;  // processes moved here from the cpu they last ran on
+    uint64 nr_preempt;     // processes preempted in the kernel by an interrupt
+
+    // wakeup-to-run latency of processes woken from SLEEPING, in cycles
+    uint64 nr_wakeups;
+    uint64 wakeup_lat_sum;
+    uint64 wakeup_lat_max;
+    uint64 wakeup_lat_hist[LAT_HIST_BUCKETS];  // log2 buckets of us, see prepare_run()
+    struct rq rq;                  // per-cpu run queue of RUNNABLE processes
 };
 
-enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+// FREEING: reaped, but pid lookups may still stand on it until a grace period ends, see freeproc().
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE, FREEING };
 
 // Per-process state
 struct proc {
@@ -51,15 +81,45 @@ struct proc {
     enum procstate state;  // Process state
     int pid;               // Process ID
     int exit_code;
-    void *sleep_chan;
+    void *sleep_chan;  // protected by the lock of the wait queue we sleep on
     int killed;
 
-    struct proc *parent;  // Parent process
+    struct proc *parent;  // Parent process, protected by parent->child_lock
+    struct proc *vfork_parent;  // the parent suspended in vfork() until we exec() or exit(), protected by its child_lock
+
+    // child_lock protects `children`, and the `parent` and `sibling` fields of each child.
+    //  Lock order: child_lock -> p->lock, and a non-init proc's child_lock -> init_proc->child_lock.
+    spinlock_t child_lock;
+    struct list_head children;  // list of child processes, linked by `sibling`
+    struct list_head sibling;   // link in parent->children
+
+    struct list_head wq_link;  // link in the wait queue we sleep on, protected by its lock
+
+    struct proc *pid_next;  // next proc in the same pid hash bucket, written under the bucket lock, read under RCU
+    struct rcu_head rcu;    // freeproc() makes the proc UNUSED after a grace period
 
     int index;
-    struct mm *mm;
-    struct vma *vma_brk;                // special vma for heap, included in mm->vma list.
-    uint64 brk;                         // end address of heap
+    int last_cpu;  // the cpu this process last ran on, -1 if never ran. protected by that cpu's rq->lock.
+
+    // scheduling state, protected by the rq->lock of the rq this process is on.
+    const struct sched_class *sched_class;
+    struct sched_entity se;
+    struct sched_dl_entity dl;
+    const struct sched_class *new_class;  // class to switch to in the next sched(), protected by p->lock
+    int on_rq;  // cpu whose rq this process is queued on, -1 if not queued.
+    int nice;   // also protected by p->lock
+    uint64 cpus_allowed;  // bit i set if this process may run on cpu i. also protected by p->lock
+
+    uint64 wakeup_time;  // when woken up from SLEEPING, 0 once it runs.
+
+    void (*kthread_fn)(void *);  // entry of a kernel thread, NULL for a user process
+    void *kthread_arg;
+
+    // FP state, only accessed by the process itself, see fpu.c
+    struct fpstate fpstate;
+    int fp_used;  // has executed an FP instruction, sstatus.FS is Off for user otherwise.
+    int fp_cpu;   // the cpu whose FP registers hold our state, if we are its fp_owner.
+    struct mm *mm;                      // address space, may be shared with vfork() children and threads
     struct trapframe *__kva trapframe;  // data page for trampoline.S
     uint64 __kva kstack;                // Virtual address of kernel stack
     struct context context;             // swtch() here to run process
@@ -85,10 +145,15 @@ static inline struct proc *curr_proc() {
 void proc_init();
 struct proc *allocproc();
 int fork();
+int vfork();
+int clone(uint64 entry, uint64 arg, uint64 stack, uint64 tls);
+int spawn(char *name, char *args[]);
+struct proc *kthread_create(void (*fn)(void *), void *arg, uint64 cpus);
 int exec(char *name, char *arg[]);
 int wait(int, int *);
 void exit(int);
 int kill(int pid);
+struct proc *pid_lookup(int pid);
 int iskilled(struct proc *);
 void setkilled(struct proc *, int reason);
 
@@ -98,7 +163,9 @@ void wakeup(void *chan);
 // sched.c
 void scheduler() __attribute__((noreturn));
 void sched();
+void finish_switch();
 void yield();
+void sched_yield();
 void add_task(struct proc *);
 
 // swtch.S
@@ -1,37 +1,76 @@
 #include "queue.h"
 
 #include "defs.h"
-#include "log.h"
-#include "proc.h"
 
-void init_queue(struct queue *q) {
-    spinlock_init(&q->lock, "queue");
-    q->front = q->tail = 0;
-    q->empty           = 1;
+// Returns -EINVAL if size is not a power of 2.
+int init_queue(struct queue *q, struct queue_slot *slots, int size) {
+    if (size <= 0 || (size & (size - 1)) != 0)
+        return -EINVAL;
+    q->slots = slots;
+    q->mask  = size - 1;
+    for (int i = 0; i < size; i++) {
+        slots[i].seq  = i;
+        slots[i].data = NULL;
+    }
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    return 0;
 }
 
-void push_queue(struct queue *q, void *data) {
-    acquire(&q->lock);
-    if (!q->empty && q->front == q->tail) {
-        panic("queue overflow");
+// Returns 0, or -EAGAIN if the queue is full.
+int push_queue(struct queue *q, void *data) {
+    assert(data != NULL);
+
+    // a producer switched out between its claim and its handover would hold up the consumers of its slot.
+    push_off();
+    uint64 pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    struct queue_slot *slot;
+    for (;;) {
+        slot       = &q->slots[pos & q->mask];
+        uint64 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64 diff = (int64)seq - (int64)pos;
+        if (diff == 0) {
+            // our turn: claim pos. on failure, pos is reloaded.
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // the slot still holds the data of the previous lap.
+            pop_off();
+            return -EAGAIN;
+        } else {
+            // another producer took pos.
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
     }
-    q->empty         = 0;
-    q->data[q->tail] = data;
-    q->tail          = (q->tail + 1) % NPROC;
-    release(&q->lock);
+    slot->data = data;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    pop_off();
+    return 0;
 }
 
+// Returns the oldest data, or NULL if the queue is empty.
 void *pop_queue(struct queue *q) {
-    acquire(&q->lock);
-    if (q->empty) {
-        release(&q->lock);
-        return NULL;
+    push_off();
+    uint64 pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    struct queue_slot *slot;
+    for (;;) {
+        slot       = &q->slots[pos & q->mask];
+        uint64 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64 diff = (int64)seq - (int64)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // not produced yet.
+            pop_off();
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
     }
-
-    void *data = q->data[q->front];
-    q->front   = (q->front + 1) % NPROC;
-    if (q->front == q->tail)
-        q->empty = 1;
-    release(&q->lock);
+    void *data = slot->data;
+    // free the slot for the producer of the next lap.
+    __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    pop_off();
     return data;
 }
@@ -1,20 +1,31 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
-#include "lock.h"
+#include "types.h"
 
-#define QUEUE_SIZE (1024)
+#define CACHE_LINE_SIZE (64)
 
+// A slot of a queue. seq tells whose turn the slot is: a producer's at enqueue position pos when seq == pos,
+//  a consumer's at dequeue position pos when seq == pos + 1.
+struct queue_slot {
+    uint64 seq;
+    void *data;
+};
+
+// Bounded lock-free multi-producer, multi-consumer FIFO ring, after Vyukov's MPMC queue.
+//  Producers and consumers claim a position with a CAS on their own counter, then hand the slot over with its seq,
+//  so they never wait for each other unless the ring is full or empty.
+//  Any context may use it, including interrupt handlers. NULL cannot be queued.
+//  The slots are given by the user, their number is a power of 2.
 struct queue {
-    spinlock_t lock;
-    void *data[QUEUE_SIZE];
-    int front;
-    int tail;
-    int empty;
+    struct queue_slot *slots;
+    uint64 mask;  // number of slots - 1
+    uint64 enqueue_pos __attribute__((aligned(CACHE_LINE_SIZE)));  // next position to produce, on its own line
+    uint64 dequeue_pos __attribute__((aligned(CACHE_LINE_SIZE)));  // next position to consume
 };
 
-void init_queue(struct queue *);
-void push_queue(struct queue *, void *);
-void *pop_queue(struct queue *);
+int init_queue(struct queue *q, struct queue_slot *slots, int size);
+int push_queue(struct queue *q, void *data);
+void *pop_queue(struct queue *q);
 
 #endif  // QUEUE_H
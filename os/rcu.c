@@ -0,0 +1,168 @@
+#include "rcu.h"
+
+#include "defs.h"
+#include "workqueue.h"
+
+// Each cpu counts its quiescent states in c->rcu_seq, which is odd while the cpu is in an extended quiescent state,
+//  user mode or idle, where it may stay for long without switching context.
+//  A grace period snapshots every rcu_seq when it starts,
+//  and ends once each cpu was quiescent at the snapshot or has moved on since.
+//  The tick of any cpu advances it; an idle cpu keeps its tick while callbacks wait.
+//  Finished callbacks run in the worker of the cpu that ended the grace period.
+static struct {
+    spinlock_t lock;
+    struct rcu_head *next, **next_tail;  // callbacks for the next grace period
+    struct rcu_head *wait, **wait_tail;  // callbacks waiting for the current one
+    struct rcu_head *done, **done_tail;  // callbacks whose grace period is over
+    int gp_active;
+    uint64 snap[NCPU];  // rcu_seq of each cpu when the current grace period started
+    struct work work;
+    spinlock_t barrier_lock;  // protects rcu_barrier()'s `done` flags
+} rcu;
+
+static void rcu_work(struct work *w) {
+    acquire(&rcu.lock);
+    struct rcu_head *head = rcu.done;
+    rcu.done              = NULL;
+    rcu.done_tail         = &rcu.done;
+    release(&rcu.lock);
+
+    while (head) {
+        struct rcu_head *next = head->next;
+        head->func(head);
+        head = next;
+    }
+}
+
+void rcu_init() {
+    spinlock_init(&rcu.lock, "rcu");
+    rcu.next      = rcu.wait = rcu.done = NULL;
+    rcu.next_tail = &rcu.next;
+    rcu.wait_tail = &rcu.wait;
+    rcu.done_tail = &rcu.done;
+    rcu.gp_active = 0;
+    work_init(&rcu.work, rcu_work);
+    spinlock_init(&rcu.barrier_lock, "rcu_barrier");
+}
+
+// A context switch can't happen in between, see preemptible() in sched.c, and sched() refuses to sleep.
+void rcu_read_lock() {
+    preempt_disable();
+}
+
+void rcu_read_unlock() {
+    preempt_enable();
+}
+
+// Call func(head) after a grace period: no reader can still see what the caller unlinked before.
+//  func runs in process context, in a worker. Safe to call from an interrupt handler, or holding a p->lock.
+//  Lock order: p->lock -> rcu.lock.
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *)) {
+    head->next = NULL;
+    head->func = func;
+    acquire(&rcu.lock);
+    *rcu.next_tail = head;
+    rcu.next_tail  = &head->next;
+    release(&rcu.lock);
+}
+
+struct rcu_barrier {
+    struct rcu_head head;
+    int done;
+};
+
+static void rcu_barrier_fn(struct rcu_head *head) {
+    struct rcu_barrier *b = container_of(head, struct rcu_barrier, head);
+    acquire(&rcu.barrier_lock);
+    b->done = 1;
+    wakeup(b);
+    release(&rcu.barrier_lock);
+}
+
+// Sleep until a grace period is over and the worker has run the callbacks queued before.
+//  Callbacks finished by another cpu's worker may still be running, callers retry what they waited for.
+//  Process context only, without any lock, and not in a worker.
+void rcu_barrier() {
+    struct rcu_barrier b;
+    b.done = 0;
+    call_rcu(&b.head, rcu_barrier_fn);
+
+    acquire(&rcu.barrier_lock);
+    while (!b.done)
+        sleep(&b, &rcu.barrier_lock);
+    release(&rcu.barrier_lock);
+}
+
+// This cpu is between two processes, in no read-side critical section. Interrupts are off.
+void rcu_note_qs() {
+    struct cpu *c = mycpu();
+    // the readers' accesses are done before the grace period can see it.
+    __atomic_store_n(&c->rcu_seq, c->rcu_seq + 2, __ATOMIC_RELEASE);
+}
+
+// Enter user mode or idle, where this cpu reads nothing. Interrupts are off.
+void rcu_eqs_enter() {
+    struct cpu *c = mycpu();
+    assert((c->rcu_seq & 1) == 0);
+    __atomic_store_n(&c->rcu_seq, c->rcu_seq + 1, __ATOMIC_RELEASE);
+}
+
+// Back in the kernel: readers from now on are seen by a grace period starting after this,
+//  or see what was unlinked before one that sees us quiescent.
+void rcu_eqs_exit() {
+    struct cpu *c = mycpu();
+    assert((c->rcu_seq & 1) == 1);
+    __atomic_store_n(&c->rcu_seq, c->rcu_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static int gp_done() {
+    for (int i = 0; i < NCPU; i++) {
+        struct cpu *c = getcpu(i);
+        if (!c->online)
+            continue;
+        if ((rcu.snap[i] & 1) == 0 && __atomic_load_n(&c->rcu_seq, __ATOMIC_ACQUIRE) == rcu.snap[i])
+            return 0;
+    }
+    return 1;
+}
+
+// Advance grace periods, called by the tick and before idling. Interrupts are off.
+void rcu_check() {
+    // racy read, there is nothing to do most of the time.
+    if (!__atomic_load_n(&rcu.gp_active, __ATOMIC_RELAXED) && __atomic_load_n(&rcu.next, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    int finished = 0;
+    acquire(&rcu.lock);
+    if (rcu.gp_active && gp_done()) {
+        *rcu.done_tail = rcu.wait;
+        rcu.done_tail  = rcu.wait_tail;
+        rcu.wait       = NULL;
+        rcu.wait_tail  = &rcu.wait;
+        rcu.gp_active  = 0;
+        finished       = 1;
+    }
+    if (!rcu.gp_active && rcu.next != NULL) {
+        rcu.wait      = rcu.next;
+        rcu.wait_tail = rcu.next_tail;
+        rcu.next      = NULL;
+        rcu.next_tail = &rcu.next;
+        // paired with rcu_eqs_exit(): the callers unlinked their data before this,
+        //  a cpu found in user mode or idle will see that once back.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (int i = 0; i < NCPU; i++)
+            rcu.snap[i] = __atomic_load_n(&getcpu(i)->rcu_seq, __ATOMIC_ACQUIRE);
+        rcu.gp_active = 1;
+    }
+    release(&rcu.lock);
+
+    // not under rcu.lock: waking the worker takes its p->lock, and call_rcu() may be called holding one.
+    if (finished)
+        queue_work(&rcu.work);
+}
+
+// Whether grace periods are in progress, so that an idle cpu should keep its tick to advance them.
+int rcu_needs_cpu() {
+    return __atomic_load_n(&rcu.gp_active, __ATOMIC_RELAXED) || __atomic_load_n(&rcu.next, __ATOMIC_RELAXED) != NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include "types.h"
+
+// Read-copy-update: readers traverse shared data without any lock,
+//  and writers defer freeing what they unlinked until every reader that could see it is gone.
+//  A read-side critical section is between rcu_read_lock() and rcu_read_unlock(); it must not sleep.
+//  A grace period ends once every cpu went through a quiescent state, outside any of them:
+//  a context switch, user mode, or idle.
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *);
+};
+
+void rcu_init();
+void rcu_read_lock();
+void rcu_read_unlock();
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+void rcu_barrier();
+void rcu_note_qs();
+void rcu_eqs_enter();
+void rcu_eqs_exit();
+void rcu_check();
+int rcu_needs_cpu();
+
+#endif  // RCU_H
@@ -12,6 +12,13 @@
 #define SSTATUS_SPIE (1L << 5)   // Supervisor Previous Interrupt Enable
 #define SSTATUS_SIE  (1L << 1)   // Supervisor Interrupt Enable
 
+// sstatus.FS, the state of the floating-point registers
+#define SSTATUS_FS         (3L << 13)
+#define SSTATUS_FS_OFF     (0L << 13)  // FP instructions trap
+#define SSTATUS_FS_INITIAL (1L << 13)
+#define SSTATUS_FS_CLEAN   (2L << 13)  // registers match the saved state
+#define SSTATUS_FS_DIRTY   (3L << 13)  // registers modified since saved
+
 static inline uint64 r_sstatus() {
     uint64 x;
     asm volatile("csrr %0, sstatus" : "=r"(x));
@@ -42,6 +49,9 @@ static inline void w_stimecmp(uint64 x) {
 #define SIE_SEIE (1L << 9)  // external
 #define SIE_STIE (1L << 5)  // timer
 #define SIE_SSIE (1L << 1)  // software
+
+// Supervisor Interrupt Pending
+#define SIP_SSIP (1L << 1)  // software
 static inline uint64 r_sie() {
     uint64 x;
     asm volatile("csrr %0, sie" : "=r"(x));
@@ -182,6 +192,13 @@ static inline void sfence_vma() {
     asm volatile("sfence.vma zero, zero");
 }
 
+// spin-wait hint: Zihintpause `pause`, encoded as `fence w, 0`,
+//  which harts without the extension execute as a no-op fence.
+//  Spelled out, as the toolchain targets plain rv64g.
+static inline void cpu_relax() {
+    asm volatile(".word 0x0100000f" ::: "memory");
+}
+
 #define PGSIZE    4096      // bytes per page
 #define PGSIZE_2M 0x200000  // bytes per page
 #define PGSHIFT   12        // bits of offset within a page
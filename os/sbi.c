@@ -16,6 +16,7 @@ const uint64 SBI_SHUTDOWN = 8;
 // SBI Extension: Specify EID and FID.
 const uint64 SBI_EID_BASE = 0x10;
 const uint64 SBI_EID_HSM = 0x48534D;
+const uint64 SBI_EID_IPI = 0x735049;
 
 static int inline sbi_call_legacy(uint64 which, uint64 arg0, uint64 arg1, uint64 arg2)
 {
@@ -51,6 +52,20 @@ int sbi_hsm_hart_start(unsigned long hartid, unsigned long start_addr, unsigned
 	return ret.error;
 }
 
+// Send a supervisor software interrupt to the harts in hart_mask, which is relative to hart_mask_base.
+int sbi_send_ipi(unsigned long hart_mask, unsigned long hart_mask_base)
+{
+	struct sbiret ret = sbi_call(SBI_EID_IPI, 0x0, hart_mask, hart_mask_base, 0);
+	return ret.error;
+}
+
+// Flush the whole TLB of the harts in hart_mask.
+void sbi_remote_sfence_vma(unsigned long hart_mask)
+{
+	// the legacy call takes the address of the mask.
+	sbi_call_legacy(SBI_REMOTE_SFENCE_VMA, (uint64)&hart_mask, 0, -1UL);
+}
+
 uint64 sbi_get_mvendorid(void) {
 	struct sbiret ret = sbi_call(SBI_EID_BASE, 0x04, 0, 0, 0);
 	return ret.value;
@@ -2,31 +2,542 @@
 #include "kalloc.h"
 #include "loader.h"
 #include "proc.h"
-#include "queue.h"
+#include "sbi.h"
 #include "trap.h"
 
-static struct queue task_queue;
-
 // defined in proc.c
 extern struct proc *pool[NPROC];
 
 void sched_init() {
-    init_queue(&task_queue);
+    dl_init();
+    for (int i = 0; i < NCPU; i++) {
+        struct rq *rq = &getcpu(i)->rq;
+        spinlock_init_mcs(&rq->lock, "rq");
+        rq->cpu          = i;
+        rq->nr_queued    = 0;
+        rq->need_resched = 0;
+        rq->curr         = NULL;
+        fair_init_rq(&rq->fair);
+        dl_init_rq(&rq->dl);
+    }
+}
+
+// Initialize the scheduling state of a newly allocated process.
+void sched_fork(struct proc *p) {
+    p->sched_class  = &fair_sched_class;
+    p->on_rq        = -1;
+    p->cpus_allowed = CPUMASK_ALL;
+    p->new_class    = NULL;
+    fair_init_entity(p);
+    dl_init_entity(p);
+}
+
+static const struct sched_class *highest_class = &dl_sched_class;
+
+#define for_each_class(class) for (class = highest_class; class != NULL; class = class->next)
+
+// Isolated cpus are out of general scheduling: they only run processes allowed on no other cpu,
+//  and don't steal work. While one runs a single process, its periodic tick is stopped.
+static uint64 isolated_mask = ISOLATED_CPUS;
+
+static inline int cpu_isolated(int cpu) {
+    return (__atomic_load_n(&isolated_mask, __ATOMIC_RELAXED) >> cpu) & 1;
+}
+
+// The cpus p may be queued on.
+static uint64 task_cpus(struct proc *p) {
+    uint64 mask = p->cpus_allowed & ~__atomic_load_n(&isolated_mask, __ATOMIC_RELAXED);
+    return mask ? mask : p->cpus_allowed;
+}
+
+static void enqueue_task(struct rq *rq, struct proc *p) {
+    assert(holding(&rq->lock));
+    p->sched_class->enqueue(rq, p);
+    p->on_rq = rq->cpu;
+    rq->nr_queued++;
+}
+
+static void dequeue_task(struct rq *rq, struct proc *p) {
+    assert(holding(&rq->lock));
+    assert(p->on_rq == rq->cpu);
+    p->sched_class->dequeue(rq, p);
+    p->on_rq = -1;
+    rq->nr_queued--;
+}
+
+static struct proc *pick_next_task(struct rq *rq) {
+    const struct sched_class *class;
+    assert(holding(&rq->lock));
+    for_each_class(class) {
+        struct proc *p = class->pick_next(rq);
+        if (p != NULL) {
+            p->on_rq = -1;
+            rq->nr_queued--;
+            rq->curr         = p;
+            rq->need_resched = 0;
+            p->last_cpu      = rq->cpu;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void put_prev_task(struct rq *rq, struct proc *p) {
+    assert(holding(&rq->lock));
+    p->sched_class->put_prev(rq, p);
+    rq->curr = NULL;
+}
+
+// Lock two rqs in cpu id order, to avoid deadlock between two stealing cpus.
+static void double_rq_lock(struct rq *a, struct rq *b) {
+    if (a->cpu < b->cpu) {
+        acquire(&a->lock);
+        acquire(&b->lock);
+    } else {
+        acquire(&b->lock);
+        acquire(&a->lock);
+    }
+}
+
+static void double_rq_unlock(struct rq *a, struct rq *b) {
+    release(&a->lock);
+    release(&b->lock);
+}
+
+// Move one task from the busiest other cpu to rq.
+static int steal_task(struct rq *rq) {
+    struct rq *busiest = NULL;
+    int max            = 0;
+    if (cpu_isolated(rq->cpu))
+        return 0;
+    for (int i = 1; i < NCPU; i++) {
+        struct rq *other = &getcpu((rq->cpu + i) % NCPU)->rq;
+        // racy read, only used as a hint.
+        int n = other->nr_queued;
+        if (n > max) {
+            max     = n;
+            busiest = other;
+        }
+    }
+    if (busiest == NULL)
+        return 0;
+
+    int moved = 0;
+    const struct sched_class *class;
+    double_rq_lock(rq, busiest);
+    for_each_class(class) {
+        struct proc *p;
+        if (class->steal == NULL || (p = class->steal(busiest, rq->cpu)) == NULL)
+            continue;
+        p->on_rq = -1;
+        busiest->nr_queued--;
+        enqueue_task(rq, p);
+        getcpu(rq->cpu)->nr_migrations++;
+        moved = 1;
+        break;
+    }
+    double_rq_unlock(rq, busiest);
+    return moved;
 }
 
 static struct proc *fetch_task() {
-    struct proc *proc = pop_queue(&task_queue);
+    struct rq *rq = &mycpu()->rq;
+    struct proc *proc;
+
+    acquire(&rq->lock);
+    proc = pick_next_task(rq);
+    release(&rq->lock);
+
+    if (proc == NULL && steal_task(rq)) {
+        acquire(&rq->lock);
+        proc = pick_next_task(rq);
+        release(&rq->lock);
+    }
     if (proc != NULL)
         debugf("fetch task (pid=%d) from task queue", proc->pid);
     return proc;
 }
 
+// Bit i is set while cpu i sleeps in idle(), with no tick, and has to be woken up by an IPI.
+//  Whoever clears the bit sends the IPI, so that an idle cpu is woken up only once.
+static uint64 idle_mask;
+
+static int claim_idle_cpu(int cpu) {
+    uint64 bit = 1UL << cpu;
+    return (__atomic_fetch_and(&idle_mask, ~bit, __ATOMIC_ACQ_REL) & bit) != 0;
+}
+
+static void send_ipi(int cpu) {
+    sbi_send_ipi(1UL << getcpu(cpu)->mhart_id, 0);
+}
+
+// New work, which may run on the cpus in `allowed`, is queued on cpu `target`: wake it up if it is idle,
+//  otherwise wake up one idle allowed cpu to steal the work.
+static void kick_idle_cpu(int target, uint64 allowed) {
+    // pairs with the fetch_or in idle(): either it sees our task, or we see its bit.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64 mask = __atomic_load_n(&idle_mask, __ATOMIC_RELAXED) & allowed;
+    if (mask == 0)
+        return;
+    if ((mask & (1UL << target)) && claim_idle_cpu(target)) {
+        send_ipi(target);
+        return;
+    }
+    // racy read: the task will wait only if target is running something else.
+    if (getcpu(target)->rq.curr == NULL)
+        return;
+    for (int i = 0; i < NCPU; i++) {
+        if ((mask & (1UL << i)) && claim_idle_cpu(i)) {
+            send_ipi(i);
+            return;
+        }
+    }
+}
+
+static int cpu_allowed(struct proc *p, int cpu) {
+    return cpu >= 0 && getcpu(cpu)->online && (task_cpus(p) & (1UL << cpu));
+}
+
+// Restart the tick of cpu, stopped by sched_tick(), as another process is queued there.
+static void restart_tick(int cpu) {
+    if (cpu == cpuid()) {
+        mycpu()->tick_stopped = 0;
+        set_next_timer();
+    } else {
+        send_ipi(cpu);
+    }
+}
+
+// A deadline process out of runtime must stay off the rqs until its replenish timer fires.
+static int dl_throttled(struct proc *p) {
+    return p->sched_class == &dl_sched_class && p->dl.throttled;
+}
+
+// Put a RUNNABLE process onto a run queue.
+//  A process that has run before goes back to the cpu it last ran on, for cache locality.
+//  Otherwise it goes to the cpu that makes it runnable, i.e., the waker or the parent,
+//  or to the first online cpu p is allowed on.
 void add_task(struct proc *p) {
     assert(p->state == RUNNABLE);
     assert(holding(&p->lock));
 
-    push_queue(&task_queue, p);
-    debugf("add task (pid=%d) to task queue", p->pid);
+    if (dl_throttled(p)) {
+        // the replenish timer adds it.
+        p->dl.parked = 1;
+        return;
+    }
+
+    int target = p->last_cpu;
+    if (!cpu_allowed(p, target))
+        target = cpuid();
+    for (int i = 0; i < NCPU && !cpu_allowed(p, target); i++)
+        target = i;
+    // no allowed cpu is online yet: run it here meanwhile.
+    if (!cpu_allowed(p, target))
+        target = cpuid();
+
+    struct rq *rq = &getcpu(target)->rq;
+    acquire(&rq->lock);
+    int resched = rq->need_resched;
+    enqueue_task(rq, p);
+    if (p->last_cpu >= 0 && p->last_cpu != target)
+        getcpu(target)->nr_migrations++;
+    // sched_tick() stops the tick under rq->lock, so either it sees our task, or we see the flag.
+    int tick_stopped = getcpu(target)->tick_stopped;
+    // a deadline process that preempts curr on another cpu can't wait for its tick: send an IPI.
+    int preempt = p->sched_class == &dl_sched_class && !resched && rq->need_resched && target != cpuid();
+    release(&rq->lock);
+    debugf("add task (pid=%d) to cpu %d", p->pid, target);
+
+    if (tick_stopped)
+        restart_tick(target);
+    else if (preempt)
+        send_ipi(target);
+    kick_idle_cpu(target, task_cpus(p));
+}
+
+// Called on every tick, on every cpu.
+void sched_tick() {
+    struct cpu *c = mycpu();
+    struct rq *rq = &c->rq;
+    acquire(&rq->lock);
+    if (rq->curr != NULL)
+        rq->curr->sched_class->tick(rq, rq->curr);
+    // an isolated cpu running a single process doesn't need the tick, until add_task() queues another one.
+    if (cpu_isolated(c->cpuid) && rq->curr != NULL && rq->nr_queued == 0 && !rq->need_resched) {
+        c->tick_stopped = 1;
+        stop_tick();
+    }
+    release(&rq->lock);
+}
+
+// An IPI from add_task(): restart the tick if another process is queued here.
+void sched_ipi() {
+    struct cpu *c = mycpu();
+    struct rq *rq = &c->rq;
+    acquire(&rq->lock);
+    if (c->tick_stopped && rq->nr_queued > 0) {
+        c->tick_stopped = 0;
+        set_next_timer();
+        // let the new process run without waiting for a whole tick.
+        rq->need_resched = 1;
+    }
+    release(&rq->lock);
+}
+
+// Isolate the cpus in mask from general scheduling, replacing the previously isolated ones.
+//  At least one online cpu must stay in general scheduling.
+//  Processes queued on a newly isolated cpu move away the next time they are scheduled.
+int sched_isolate(uint64 mask) {
+    uint64 online = 0;
+    for (int i = 0; i < NCPU; i++) {
+        if (getcpu(i)->online)
+            online |= 1UL << i;
+    }
+    if ((mask & ~CPUMASK_ALL) || (online & ~mask) == 0)
+        return -EINVAL;
+
+    __atomic_store_n(&isolated_mask, mask, __ATOMIC_RELAXED);
+    for (int i = 0; i < NCPU; i++) {
+        if (!(mask & (1UL << i)))
+            continue;
+        // let the running process move away if it is not confined here.
+        struct rq *rq = &getcpu(i)->rq;
+        acquire(&rq->lock);
+        if (rq->curr != NULL)
+            rq->need_resched = 1;
+        release(&rq->lock);
+    }
+    return 0;
+}
+
+// Whether the current process should give up the cpu.
+int need_resched() {
+    push_off();
+    int ret = mycpu()->rq.need_resched;
+    pop_off();
+    return ret;
+}
+
+// Kernel preemption mode, toggled by ktest to compare them:
+//  PREEMPT_NONE      a process in the kernel runs until it sleeps or returns to user.
+//  PREEMPT_VOLUNTARY it also gives up the cpu at cond_resched() points in long loops.
+//  PREEMPT_FULL      it is also switched out when an interrupt returns to preemptible kernel code.
+int sched_preempt = PREEMPT_FULL;
+
+// Whether the running process may be switched out while it holds nr_locks spinlocks:
+//  it runs in process context, outside preempt_disable(), and had interrupts enabled before taking them.
+//  With no lock, the caller is an interrupt taken in the kernel, so interrupts were enabled.
+static int preemptible(struct cpu *c, int nr_locks) {
+    return c->proc != NULL && c->proc->state == RUNNING && c->preempt_count == 0 && c->noff == nr_locks &&
+           (nr_locks == 0 || c->interrupt_on);
+}
+
+// A preemption point for long loops in the kernel, holding no lock.
+void cond_resched() {
+    if (sched_preempt == PREEMPT_NONE || !need_resched())
+        return;
+    push_off();
+    int ok = preemptible(mycpu(), 1);
+    pop_off();
+    if (ok)
+        yield();
+}
+
+// A preemption point for long loops holding lk and no other lock. lk is dropped while others run,
+//  so the data it protects must be private to the caller, or consistent at this point.
+void cond_resched_lock(spinlock_t *lk) {
+    assert(holding(lk));
+    if (sched_preempt == PREEMPT_NONE || !need_resched() || !preemptible(mycpu(), 1))
+        return;
+    release(lk);
+    yield();
+    acquire(lk);
+}
+
+// cond_resched_lock() for a write-locked rwlock.
+void cond_resched_write_lock(rwlock_t *lk) {
+    assert(write_holding(lk));
+    if (sched_preempt == PREEMPT_NONE || !need_resched() || !preemptible(mycpu(), 1))
+        return;
+    write_unlock(lk);
+    yield();
+    write_lock(lk);
+}
+
+// Whether an interrupt taken in the kernel should switch out the process it interrupted, on its way back.
+//  Called with interrupts off, after leaving the trap context.
+int preempt_on_irq_return() {
+    struct cpu *c = mycpu();
+    return sched_preempt == PREEMPT_FULL && c->rq.need_resched && preemptible(c, 0);
+}
+
+// Lock the rq p is queued or running on. Returns NULL if p is on neither.
+//  Caller holds p->lock, so p cannot be enqueued meanwhile,
+//  but it can still be picked or stolen, hence the recheck.
+struct rq *task_rq_lock(struct proc *p) {
+    assert(holding(&p->lock));
+    for (;;) {
+        int cpu = p->on_rq >= 0 ? p->on_rq : p->last_cpu;
+        if (cpu < 0)
+            return NULL;
+        struct rq *rq = &getcpu(cpu)->rq;
+        acquire(&rq->lock);
+        if (p->on_rq == cpu || rq->curr == p)
+            return rq;
+        release(&rq->lock);
+        if (p->on_rq < 0 && cpu == p->last_cpu)
+            return NULL;
+    }
+}
+
+// Set the nice value of p. Caller holds p->lock.
+int sched_setnice(struct proc *p, int nice) {
+    assert(holding(&p->lock));
+    if (nice < NICE_MIN || nice > NICE_MAX)
+        return -EINVAL;
+
+    struct rq *rq = task_rq_lock(p);
+    if (rq != NULL && p->on_rq >= 0) {
+        // requeue, as its position in the queue depends on its weight.
+        dequeue_task(rq, p);
+        fair_reweight(NULL, p, nice);
+        enqueue_task(rq, p);
+    } else {
+        // only a fair process is accounted in rq->fair.load.
+        fair_reweight(p->sched_class == &fair_sched_class ? rq : NULL, p, nice);
+    }
+    if (rq != NULL)
+        release(&rq->lock);
+    return 0;
+}
+
+// Restrict p to the cpus in mask. Caller holds p->lock.
+//  A queued p moves to an allowed cpu at once, a running one the next time it is preempted.
+int sched_setaffinity(struct proc *p, uint64 mask) {
+    assert(holding(&p->lock));
+    mask &= CPUMASK_ALL;
+    if (mask == 0)
+        return -EINVAL;
+    // a deadline process is pinned to the cpu holding its bandwidth.
+    if (p->dl.dl_cpu >= 0)
+        return -EBUSY;
+    // so is a kernel thread, like the worker of a cpu.
+    if (p->kthread_fn != NULL)
+        return -EBUSY;
+
+    int requeue   = 0;
+    struct rq *rq = task_rq_lock(p);
+    // cpus_allowed is read under either lock, by add_task() and by stealing cpus.
+    p->cpus_allowed = mask;
+    if (rq != NULL) {
+        if (p->on_rq >= 0 && !(mask & (1UL << rq->cpu))) {
+            dequeue_task(rq, p);
+            requeue = 1;
+        } else if (rq->curr == p && !(mask & (1UL << rq->cpu))) {
+            rq->need_resched = 1;
+        }
+        release(&rq->lock);
+    }
+    if (requeue)
+        add_task(p);
+    return 0;
+}
+
+// Move the calling process p into the deadline class, with runtime, deadline and period in cycles,
+//  or back into the fair class if runtime is 0. The switch happens in sched(), as we yield here.
+//  A deadline process is pinned to the cpu it is admitted on, and its affinity is reset on leaving.
+int sched_setattr(struct proc *p, uint64 runtime, uint64 deadline, uint64 period) {
+    assert(p == curr_proc());
+    if (runtime != 0 && (runtime < DL_MIN_RUNTIME || runtime > deadline || deadline > period))
+        return -EINVAL;
+
+    int ret = 0;
+    acquire(&p->lock);
+    if (runtime == 0) {
+        if (p->dl.dl_cpu >= 0) {
+            dl_release(p);
+            p->cpus_allowed = CPUMASK_ALL;
+            p->new_class    = &fair_sched_class;
+        }
+    } else if ((ret = dl_admit(p, runtime, period)) >= 0) {
+        // we are running, the fields are read under our rq->lock.
+        struct rq *rq      = task_rq_lock(p);
+        p->dl.dl_runtime   = runtime;
+        p->dl.dl_deadline  = deadline;
+        p->dl.dl_period    = period;
+        p->dl.deadline     = 0;  // start a new period when enqueued.
+        p->cpus_allowed    = 1UL << ret;
+        p->new_class       = &dl_sched_class;
+        release(&rq->lock);
+        ret = 0;
+    }
+    release(&p->lock);
+
+    if (ret == 0)
+        yield();
+    return ret;
+}
+
+// The calling process p is exiting: give back its deadline bandwidth,
+//  and make sure its replenish timer is done before the proc can be reused.
+void sched_exit(struct proc *p) {
+    acquire(&p->lock);
+    if (p->dl.dl_cpu >= 0) {
+        // with dl_cpu < 0, we are no longer throttled, and the timer is not armed again.
+        struct rq *rq = task_rq_lock(p);
+        dl_release(p);
+        release(&rq->lock);
+    }
+    release(&p->lock);
+    // the callback takes p->lock.
+    ktimer_cancel(&p->dl.replenish_timer);
+}
+
+// Nothing to run: sleep in wfi until an interrupt.
+//  The periodic tick is stopped meanwhile, the timer only fires for pending kernel timers.
+static void idle(struct cpu *c) {
+    struct rq *rq = &c->rq;
+
+    // once our bit is set in idle_mask, add_task() sends an IPI for any new task.
+    acquire(&rq->lock);
+    // the tick is restarted below once we wake up.
+    c->tick_stopped = 0;
+    if (rq->nr_queued > 0) {
+        release(&rq->lock);
+        return;
+    }
+    __atomic_fetch_or(&idle_mask, 1UL << c->cpuid, __ATOMIC_SEQ_CST);
+    release(&rq->lock);
+
+    // work queued on other cpus before our bit was set won't send us an IPI.
+    for (int i = 0; i < NCPU; i++) {
+        if (getcpu(i)->rq.nr_queued > 0) {
+            claim_idle_cpu(c->cpuid);
+            return;
+        }
+    }
+
+    // keep the tick while grace periods wait, they may wait for us.
+    rcu_check();
+    if (!rcu_needs_cpu())
+        stop_tick();
+
+    // interrupts are off: wfi returns once one is pending, and we take it below.
+    uint64 start = r_time();
+    rcu_eqs_enter();
+    asm volatile("wfi");
+    rcu_eqs_exit();
+    c->idle_cycles += r_time() - start;
+    c->nr_idle++;
+
+    // woken up by a timer or device interrupt, rather than an IPI.
+    claim_idle_cpu(c->cpuid);
+
+    intr_on();
+    intr_off();
+    // restart the periodic tick.
+    set_next_timer();
 }
 
 static int all_dead() {
@@ -35,8 +546,8 @@ static int all_dead() {
     for (int i = 0; i < NPROC; i++) {
         struct proc *p = pool[i];
         // it's ok to read an out-dated UNUSED state,
-        //  so omit acquire&release here
-        if (p->state != UNUSED)
+        //  so omit acquire&release here. kernel threads never die.
+        if (p->state != UNUSED && p->state != FREEING && p->kthread_fn == NULL)
             alive = true;
         if (alive)
             break;
@@ -45,6 +556,41 @@ static int all_dead() {
     return !alive;
 }
 
+// Switch directly from one process to the next in sched(), without going through the scheduler context.
+//  Toggled by ktest, to compare the two.
+int sched_direct_switch = 1;
+
+// Make p the running process of c. Caller holds p->lock.
+static void prepare_run(struct cpu *c, struct proc *p) {
+    assert(p->state == RUNNABLE);
+    debugf("switch to proc %d(%d)", p->index, p->pid);
+    p->state = RUNNING;
+    c->proc  = p;
+    if (p->wakeup_time != 0) {
+        uint64 lat = r_time() - p->wakeup_time;
+        c->nr_wakeups++;
+        c->wakeup_lat_sum += lat;
+        c->wakeup_lat_max = MAX(c->wakeup_lat_max, lat);
+        p->wakeup_time    = 0;
+
+        // bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us, the last one takes the rest.
+        uint64 us  = lat / (CPU_FREQ / 1000000);
+        int bucket = us == 0 ? 0 : 64 - __builtin_clzl(us);
+        c->wakeup_lat_hist[MIN(bucket, LAT_HIST_BUCKETS - 1)]++;
+    }
+}
+
+// Called by whoever we just swtch()-ed to, be it a process or the scheduler:
+//  the process that switched away is off this cpu's stack now, release its p->lock.
+void finish_switch() {
+    struct cpu *c = mycpu();
+    struct proc *prev = c->prev;
+    if (prev != NULL) {
+        c->prev = NULL;
+        release(&prev->lock);
+    }
+}
+
 // Scheduler never returns.  It loops, doing:
 //  - choose a process to run.
 //  - swtch to start running that process.
@@ -58,69 +604,124 @@ void scheduler() {
     // After each cpu boots, it calls scheduler().
     // If this scheduler finds any possible process to run, it will switch to it.
     // 	And the scheduler context is saved on "mycpu()->sched_context"
+    c->online = 1;
+    int idled = 0;
 
     for (;;) {
         // intr may be on here.
 
         p = fetch_task();
+        if (p == NULL && idled)
+            c->nr_spurious++;
+        idled = 0;
         if (p == NULL) {
-            // if we cannot find a process in the task_queue
+            // if we cannot find a process in our run queue, nor steal one from others,
             //  maybe some processes are SLEEPING and some are RUNNABLE
             if (all_dead()) {
                 panic("[cpu %d] scheduler dead.", c->cpuid);
             } else {
                 // nothing to run; stop running on this core until an interrupt.
-                intr_on();
-                asm volatile("wfi");
-                intr_off();
+                idle(c);
+                idled = 1;
                 continue;
             }
         }
 
         acquire(&p->lock);
-        assert(p->state == RUNNABLE);
-        debugf("switch to proc %d(%d)", p->index, p->pid);
-        p->state = RUNNING;
-        c->proc  = p;
+        prepare_run(c, p);
         swtch(&c->sched_context, &p->context);
 
         // When we get back here, someone must have called swtch(..., &c->sched_context);
-        assert(c->proc == p);
-        assert(!intr_get());        // scheduler should never have intr_on()
-        assert(holding(&p->lock));  // whoever switch to us must acquire p->lock
+        //  It may not be p, which may have switched directly to another process.
+        //  sched() has already put it back to the run queue if it is RUNNABLE.
+        assert(!intr_get());  // scheduler should never have intr_on()
+        assert(c->prev != NULL && holding(&c->prev->lock));  // whoever switch to us must acquire p->lock
         c->proc = NULL;
-
-        if (p->state == RUNNABLE) {
-            add_task(p);
-        }
-        release(&p->lock);
+        finish_switch();
+        rcu_note_qs();
     }
 }
 
-// Switch to scheduler.  Must hold only p->lock
+// Switch to another process, or to the scheduler.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->noff, but that would
 // break in the few places where a lock is held but
 // there's no process.
+//
+// If another process is runnable on this cpu, switch to it directly, holding its p->lock
+//  on its behalf, and it releases our p->lock in finish_switch().
+//  Lock order: p->lock -> next->lock, for a next taken from this cpu's run queue.
+//  It can't be reversed: a process locking itself in sched() is not on any run queue yet.
+// Otherwise, switch to the scheduler, which steals work or idles.
 void sched() {
     int interrupt_on;
-    struct proc *p = curr_proc();
+    struct proc *p    = curr_proc();
+    struct cpu *c     = mycpu();
+    struct rq *rq     = &c->rq;
+    struct proc *next = NULL;
 
     if (!holding(&p->lock))
         panic("not holding p->lock");
-    if (mycpu()->noff != 1)
+    if (c->noff != 1)
         panic("holding another locks");
     if (p->state == RUNNING)
         panic("sched running process");
-    if (mycpu()->inkernel_trap)
+    if (c->inkernel_trap)
         panic("sched should never be called in kernel trap context.");
+    if (c->preempt_count)
+        panic("sched with preemption disabled");
     assert(!intr_get());
 
-    interrupt_on = mycpu()->interrupt_on;
-    debugf("switch to scheduler %d(%d)", p->index, p->pid);
-    swtch(&p->context, &mycpu()->sched_context);
+    fpu_switch_out(p);
+
+    acquire(&rq->lock);
+    put_prev_task(rq, p);
+    // sched_setattr() changes the class while p is on neither the rq nor the cpu.
+    if (p->new_class != NULL) {
+        p->sched_class = p->new_class;
+        p->new_class   = NULL;
+    }
+    // a throttled deadline process waits for its replenish timer, off the rq.
+    int park = p->state == RUNNABLE && dl_throttled(p);
+    if (park)
+        p->dl.parked = 1;
+    // p is no longer allowed here after sched_setaffinity(): move it to an allowed cpu.
+    int migrate = p->state == RUNNABLE && !park && !(task_cpus(p) & (1UL << c->cpuid));
+    if (p->state == RUNNABLE && !park && !migrate)
+        enqueue_task(rq, p);
+    if (sched_direct_switch)
+        next = pick_next_task(rq);
+    release(&rq->lock);
+
+    if (next == p) {
+        // no one else to run here, keep running.
+        p->state = RUNNING;
+        return;
+    }
+    if (migrate)
+        add_task(p);
+    else if (p->state == RUNNABLE && !park)
+        kick_idle_cpu(c->cpuid, task_cpus(p));
+
+    // p leaves the cpu: it is in no read-side critical section.
+    rcu_note_qs();
+
+    interrupt_on = c->interrupt_on;
+    c->prev      = p;
+    if (next != NULL) {
+        acquire(&next->lock);
+        prepare_run(c, next);
+        debugf("switch from proc %d(%d) directly", p->index, p->pid);
+        swtch(&p->context, &next->context);
+    } else {
+        debugf("switch to scheduler %d(%d)", p->index, p->pid);
+        swtch(&p->context, &c->sched_context);
+    }
+
+    // someone switched back to us, holding our p->lock. We may be on another cpu now.
+    finish_switch();
     mycpu()->interrupt_on = interrupt_on;
 
     // if scheduler returns here: p->lock must be holding.
@@ -138,3 +739,19 @@ void yield() {
     sched();
     release(&p->lock);
 }
+
+// yield() for the yield syscall: also let pick_next skip us once, so that others get a chance to run.
+void sched_yield() {
+    struct proc *p = curr_proc();
+
+    acquire(&p->lock);
+    // the fair class reads and clears the flag under rq->lock.
+    struct rq *rq = task_rq_lock(p);
+    if (rq != NULL) {
+        p->se.yielded = 1;
+        release(&rq->lock);
+    }
+    p->state = RUNNABLE;
+    sched();
+    release(&p->lock);
+}
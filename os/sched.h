@@ -0,0 +1,147 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "lock.h"
+#include "timer.h"
+#include "types.h"
+
+struct proc;
+struct rq;
+
+// Scheduling class interface.
+//  Every RUNNABLE process belongs to exactly one class, p->sched_class.
+//  Classes are chained by `next` from the highest priority to the lowest,
+//  and pick_next_task() asks each class in turn.
+//  All hooks are called with rq->lock held.
+struct sched_class {
+    const char *name;
+    const struct sched_class *next;
+
+    // p becomes queued on rq.
+    void (*enqueue)(struct rq *rq, struct proc *p);
+    // p, queued on rq, is removed from rq.
+    void (*dequeue)(struct rq *rq, struct proc *p);
+    // choose the next process to run, remove it from the queue and make it rq->curr.
+    struct proc *(*pick_next)(struct rq *rq);
+    // rq->curr stops running on rq.
+    void (*put_prev)(struct rq *rq, struct proc *p);
+    // called on every timer tick for rq->curr.
+    void (*tick)(struct rq *rq, struct proc *curr);
+    // remove a queued process from rq, for another cpu to run it. optional.
+    struct proc *(*steal)(struct rq *rq, int dst_cpu);
+};
+
+// Per-process scheduling entity of the fair class.
+struct sched_entity {
+    uint64 vruntime;  // virtual runtime, relative to rq's min_vruntime when not on a cpu.
+    uint64 exec_start;
+    uint64 sum_exec_runtime;
+    uint64 prev_sum_exec_runtime;  // sum_exec_runtime when picked
+    uint64 weight;
+    int heap_index;  // index in fair_rq.heap, -1 if not queued
+    int yielded;     // skip this entity once in pick_next, set by sched_yield().
+};
+
+// Parameters of the deadline class, from sched_setattr(), in ns. runtime 0 returns to the fair class.
+struct sched_attr {
+    uint64 runtime;
+    uint64 deadline;
+    uint64 period;
+};
+
+// Per-process scheduling entity of the deadline class.
+//  The process is guaranteed dl_runtime of cpu time in every dl_period, within dl_deadline from its start.
+//  Times are in cycles of r_time().
+struct sched_dl_entity {
+    uint64 dl_runtime;
+    uint64 dl_deadline;
+    uint64 dl_period;
+    uint64 dl_bw;  // dl_runtime / dl_period, in units of 1 / (1 << DL_BW_SHIFT)
+    int dl_cpu;    // the cpu whose bandwidth it holds, -1 if not admitted. protected by dl_bw_lock
+
+    int64 runtime;    // runtime left in the current period
+    uint64 deadline;  // absolute deadline of the current period
+    uint64 exec_start;
+    int heap_index;  // index in dl_rq.heap, -1 if not queued
+    int throttled;   // out of runtime, until replenish_timer fires
+    int parked;      // throttled while RUNNABLE, kept off every rq. protected by p->lock
+    struct ktimer replenish_timer;
+};
+
+#define DL_BW_SHIFT     (20)
+#define DL_BW_LIMIT     ((95UL << DL_BW_SHIFT) / 100)  // at most 95% of a cpu, the rest is for the fair class
+#define DL_MIN_RUNTIME  (CPU_FREQ / 10000)            // 100us
+
+struct dl_rq {
+    struct proc **heap;  // min-heap of queued processes keyed by absolute deadline, NPROC entries
+    int nr;
+    struct ktimer budget_timer;  // fires when rq->curr runs out of runtime
+};
+
+#define CPUMASK_ALL ((1UL << NCPU) - 1)
+
+#define NICE_MIN       (-20)
+#define NICE_MAX       (19)
+#define NICE_0_WEIGHT  (1024)
+
+// fair class tunables, in cycles of r_time().
+#define SCHED_LATENCY         (4 * TICK_CYCLES)  // period in which every runnable process runs once
+#define SCHED_MIN_GRANULARITY (TICK_CYCLES)      // a process runs at least this long before preempted
+#define SCHED_WAKEUP_GRAN     (TICK_CYCLES)      // a waking process preempts curr if it lags this much
+
+// kernel preemption modes, see sched_preempt.
+#define PREEMPT_NONE      (0)
+#define PREEMPT_VOLUNTARY (1)
+#define PREEMPT_FULL      (2)
+
+struct fair_rq {
+    struct proc **heap;  // min-heap of queued processes keyed by vruntime, NPROC entries
+    int nr;
+    uint64 min_vruntime;  // monotonic
+    uint64 load;          // sum of weights of queued processes and curr
+};
+
+// Per-cpu run queue.
+struct rq {
+    spinlock_t lock;
+    int cpu;
+    int nr_queued;      // processes waiting in this rq, curr excluded
+    int need_resched;   // curr should give up the cpu at the next chance
+    struct proc *curr;  // process running on this cpu, NULL if idle
+    struct fair_rq fair;
+    struct dl_rq dl;
+};
+
+extern const struct sched_class fair_sched_class;
+extern const struct sched_class dl_sched_class;
+
+// sched.c
+void sched_init();
+void sched_fork(struct proc *p);
+void sched_tick();
+void sched_ipi();
+int sched_isolate(uint64 mask);
+int need_resched();
+int sched_setnice(struct proc *p, int nice);
+int sched_setaffinity(struct proc *p, uint64 mask);
+int sched_setattr(struct proc *p, uint64 runtime, uint64 deadline, uint64 period);
+void sched_exit(struct proc *p);
+struct rq *task_rq_lock(struct proc *p);
+void cond_resched();
+void cond_resched_lock(spinlock_t *lk);
+void cond_resched_write_lock(rwlock_t *lk);
+int preempt_on_irq_return();
+
+// sched_fair.c
+void fair_init_rq(struct fair_rq *fair);
+void fair_init_entity(struct proc *p);
+void fair_reweight(struct rq *rq, struct proc *p, int nice);
+
+// sched_dl.c
+void dl_init();
+void dl_init_rq(struct dl_rq *dl);
+void dl_init_entity(struct proc *p);
+int dl_admit(struct proc *p, uint64 runtime, uint64 period);
+void dl_release(struct proc *p);
+
+#endif  // SCHED_H
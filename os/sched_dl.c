@@ -0,0 +1,265 @@
+#include "defs.h"
+#include "proc.h"
+#include "sched.h"
+
+// Deadline scheduling class: Earliest Deadline First, with a Constant Bandwidth Server per process.
+//
+// A process in this class asks for dl_runtime of cpu time in every dl_period.
+//  Admission control keeps the bandwidth (dl_runtime / dl_period) of the processes admitted
+//  on a cpu under DL_BW_LIMIT, so that EDF meets all their deadlines there, and the fair class
+//  still gets some time. A process is pinned to the cpu it is admitted on.
+// The queued process with the earliest absolute deadline runs first, before any fair process.
+//  A process that used up its runtime is throttled until its next period starts,
+//  so that an overrunning process cannot take the time reserved for others.
+
+static spinlock_t dl_bw_lock;
+static uint64 dl_bw_used[NCPU];  // bandwidth admitted on each cpu, protected by dl_bw_lock
+
+static inline int dl_before(struct proc *a, struct proc *b) {
+    return (int64)(a->dl.deadline - b->dl.deadline) < 0;
+}
+
+static int is_dl(struct proc *p) {
+    return p != NULL && p->sched_class == &dl_sched_class;
+}
+
+// min-heap helpers, as in sched_fair.c
+
+static inline void heap_set(struct dl_rq *d, int i, struct proc *p) {
+    d->heap[i]       = p;
+    p->dl.heap_index = i;
+}
+
+static void sift_up(struct dl_rq *d, int i) {
+    struct proc *p = d->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!dl_before(p, d->heap[parent]))
+            break;
+        heap_set(d, i, d->heap[parent]);
+        i = parent;
+    }
+    heap_set(d, i, p);
+}
+
+static void sift_down(struct dl_rq *d, int i) {
+    struct proc *p = d->heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= d->nr)
+            break;
+        if (child + 1 < d->nr && dl_before(d->heap[child + 1], d->heap[child]))
+            child++;
+        if (!dl_before(d->heap[child], p))
+            break;
+        heap_set(d, i, d->heap[child]);
+        i = child;
+    }
+    heap_set(d, i, p);
+}
+
+static void heap_insert(struct dl_rq *d, struct proc *p) {
+    assert(d->nr < NPROC);
+    heap_set(d, d->nr++, p);
+    sift_up(d, d->nr - 1);
+}
+
+static void heap_remove(struct dl_rq *d, struct proc *p) {
+    int i = p->dl.heap_index;
+    assert(i >= 0 && i < d->nr && d->heap[i] == p);
+
+    d->nr--;
+    if (i != d->nr) {
+        struct proc *last = d->heap[d->nr];
+        heap_set(d, i, last);
+        sift_down(d, i);
+        sift_up(d, last->dl.heap_index);
+    }
+    p->dl.heap_index = -1;
+}
+
+// charge the cpu time used by rq->curr, and throttle it once out of runtime.
+static void update_curr_dl(struct rq *rq) {
+    struct proc *curr = rq->curr;
+    if (!is_dl(curr))
+        return;
+
+    struct sched_dl_entity *dl = &curr->dl;
+    uint64 now                 = r_time();
+    dl->runtime -= now - dl->exec_start;
+    dl->exec_start = now;
+
+    // a process leaving the class (dl_cpu < 0) is no longer throttled.
+    if (dl->runtime <= 0 && !dl->throttled && dl->dl_cpu >= 0) {
+        // the replenish timer clears `throttled`, so it is armed once at a time.
+        dl->throttled = 1;
+        ktimer_add(&dl->replenish_timer, dl->deadline - dl->dl_deadline + dl->dl_period);
+        rq->need_resched = 1;
+    }
+}
+
+// rq->curr ran out of runtime before the tick.
+static void budget_timer_fn(struct ktimer *t) {
+    struct rq *rq = container_of(t, struct rq, dl.budget_timer);
+    acquire(&rq->lock);
+    update_curr_dl(rq);
+    release(&rq->lock);
+}
+
+// The next period of a throttled process starts.
+static void replenish_timer_fn(struct ktimer *t) {
+    struct proc *p             = container_of(t, struct proc, dl.replenish_timer);
+    struct sched_dl_entity *dl = &p->dl;
+
+    acquire(&p->lock);
+    struct rq *rq = task_rq_lock(p);
+    // the overrun is paid back from the next periods.
+    while (dl->runtime <= 0) {
+        dl->deadline += dl->dl_period;
+        dl->runtime += dl->dl_runtime;
+    }
+    dl->throttled = 0;
+    if (rq != NULL)
+        release(&rq->lock);
+
+    // it was RUNNABLE and kept off the rqs by sched() or add_task().
+    if (dl->parked) {
+        dl->parked = 0;
+        add_task(p);
+    }
+    release(&p->lock);
+}
+
+void dl_init() {
+    spinlock_init(&dl_bw_lock, "dl_bw");
+}
+
+void dl_init_rq(struct dl_rq *d) {
+    static_assert(NPROC * sizeof(struct proc *) <= PGSIZE);
+    void *__pa pa = kallocpage();
+    assert(pa);
+    d->heap = (struct proc **)PA_TO_KVA(pa);
+    d->nr   = 0;
+    ktimer_init(&d->budget_timer, budget_timer_fn);
+}
+
+void dl_init_entity(struct proc *p) {
+    struct sched_dl_entity *dl = &p->dl;
+    dl->dl_runtime  = 0;
+    dl->dl_deadline = 0;
+    dl->dl_period   = 0;
+    dl->dl_bw       = 0;
+    dl->dl_cpu      = -1;
+    dl->runtime     = 0;
+    dl->deadline    = 0;
+    dl->exec_start  = 0;
+    dl->heap_index  = -1;
+    dl->throttled   = 0;
+    dl->parked      = 0;
+    ktimer_init(&dl->replenish_timer, replenish_timer_fn);
+}
+
+/// Reserve the bandwidth of (runtime, period) for p on the least loaded cpu that p is allowed on and fits it.
+///  Any bandwidth p held before is given back first. Caller holds p->lock.
+///  Returns the cpu, or -EBUSY if no cpu has enough bandwidth left.
+int dl_admit(struct proc *p, uint64 runtime, uint64 period) {
+    assert(holding(&p->lock));
+    uint64 bw = (runtime << DL_BW_SHIFT) / period;
+    int best  = -1;
+
+    acquire(&dl_bw_lock);
+    if (p->dl.dl_cpu >= 0)
+        dl_bw_used[p->dl.dl_cpu] -= p->dl.dl_bw;
+    for (int i = 0; i < NCPU; i++) {
+        if (!(p->cpus_allowed & (1UL << i)) || !getcpu(i)->online)
+            continue;
+        if (dl_bw_used[i] + bw > DL_BW_LIMIT)
+            continue;
+        if (best < 0 || dl_bw_used[i] < dl_bw_used[best])
+            best = i;
+    }
+    if (best < 0) {
+        if (p->dl.dl_cpu >= 0)
+            dl_bw_used[p->dl.dl_cpu] += p->dl.dl_bw;
+        release(&dl_bw_lock);
+        return -EBUSY;
+    }
+    dl_bw_used[best] += bw;
+    p->dl.dl_cpu = best;
+    p->dl.dl_bw  = bw;
+    release(&dl_bw_lock);
+    return best;
+}
+
+/// Give back the bandwidth reserved for p. Caller holds p->lock.
+void dl_release(struct proc *p) {
+    assert(holding(&p->lock));
+    acquire(&dl_bw_lock);
+    if (p->dl.dl_cpu >= 0)
+        dl_bw_used[p->dl.dl_cpu] -= p->dl.dl_bw;
+    p->dl.dl_cpu = -1;
+    p->dl.dl_bw  = 0;
+    release(&dl_bw_lock);
+}
+
+static void enqueue_dl(struct rq *rq, struct proc *p) {
+    struct sched_dl_entity *dl = &p->dl;
+    uint64 now                 = r_time();
+
+    // CBS wakeup rule: start a new period if the deadline has passed,
+    //  or if the runtime left would exceed our bandwidth until the deadline.
+    if ((int64)(dl->deadline - now) <= 0 ||
+        (uint64)dl->runtime * dl->dl_deadline > dl->dl_runtime * (dl->deadline - now)) {
+        dl->deadline = now + dl->dl_deadline;
+        dl->runtime  = dl->dl_runtime;
+    }
+    heap_insert(&rq->dl, p);
+
+    // preempt a fair curr, or a deadline curr with a later deadline.
+    //  add_task() sends an IPI if rq is another cpu's, so that it doesn't wait for the next tick.
+    struct proc *curr = rq->curr;
+    if (curr != NULL && curr != p && (!is_dl(curr) || dl_before(p, curr)))
+        rq->need_resched = 1;
+}
+
+static void dequeue_dl(struct rq *rq, struct proc *p) {
+    heap_remove(&rq->dl, p);
+}
+
+static struct proc *pick_next_dl(struct rq *rq) {
+    struct dl_rq *d = &rq->dl;
+    if (d->nr == 0)
+        return NULL;
+
+    struct proc *p = d->heap[0];
+    heap_remove(d, p);
+    // the tick is too coarse to enforce a runtime of a few ms, stop it right on time.
+    p->dl.exec_start = r_time();
+    ktimer_add(&d->budget_timer, p->dl.exec_start + p->dl.runtime);
+    return p;
+}
+
+static void put_prev_dl(struct rq *rq, struct proc *p) {
+    assert(rq->curr == p);
+    update_curr_dl(rq);
+    // added on this cpu, and its callback cannot run here now, as interrupts are off.
+    ktimer_cancel(&rq->dl.budget_timer);
+}
+
+static void tick_dl(struct rq *rq, struct proc *curr) {
+    update_curr_dl(rq);
+    if (rq->dl.nr > 0 && dl_before(rq->dl.heap[0], curr))
+        rq->need_resched = 1;
+}
+
+// No steal hook: deadline processes stay on the cpu they are admitted on.
+const struct sched_class dl_sched_class = {
+    .name      = "deadline",
+    .next      = &fair_sched_class,
+    .enqueue   = enqueue_dl,
+    .dequeue   = dequeue_dl,
+    .pick_next = pick_next_dl,
+    .put_prev  = put_prev_dl,
+    .tick      = tick_dl,
+    .steal     = NULL,
+};
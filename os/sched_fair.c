@@ -0,0 +1,276 @@
+#include "defs.h"
+#include "proc.h"
+#include "sched.h"
+
+// Fair scheduling class, in the style of Linux's CFS.
+//
+// Each process accumulates virtual runtime: the cpu time it used, scaled by
+//  NICE_0_WEIGHT / weight. The process with the smallest vruntime runs next,
+//  so over time every process gets cpu time proportional to its weight.
+//
+// Queued processes are kept in a binary min-heap keyed by vruntime.
+// While a process is not on a cpu's rq (sleeping, or migrating), its vruntime
+//  is kept relative to the min_vruntime of the rq it left, and is re-based on
+//  the min_vruntime of the rq it is enqueued on.
+
+// nice -> weight. Each nice level is worth about 10% of cpu time.
+//  Taken from Linux's sched_prio_to_weight[].
+static const uint64 prio_to_weight[40] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
+
+static inline int entity_before(struct proc *a, struct proc *b) {
+    return (int64)(a->se.vruntime - b->se.vruntime) < 0;
+}
+
+// min-heap helpers
+
+static inline void heap_set(struct fair_rq *f, int i, struct proc *p) {
+    f->heap[i]       = p;
+    p->se.heap_index = i;
+}
+
+static void sift_up(struct fair_rq *f, int i) {
+    struct proc *p = f->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!entity_before(p, f->heap[parent]))
+            break;
+        heap_set(f, i, f->heap[parent]);
+        i = parent;
+    }
+    heap_set(f, i, p);
+}
+
+static void sift_down(struct fair_rq *f, int i) {
+    struct proc *p = f->heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= f->nr)
+            break;
+        if (child + 1 < f->nr && entity_before(f->heap[child + 1], f->heap[child]))
+            child++;
+        if (!entity_before(f->heap[child], p))
+            break;
+        heap_set(f, i, f->heap[child]);
+        i = child;
+    }
+    heap_set(f, i, p);
+}
+
+static void heap_insert(struct fair_rq *f, struct proc *p) {
+    assert(f->nr < NPROC);
+    heap_set(f, f->nr++, p);
+    sift_up(f, f->nr - 1);
+}
+
+static void heap_remove(struct fair_rq *f, struct proc *p) {
+    int i = p->se.heap_index;
+    assert(i >= 0 && i < f->nr && f->heap[i] == p);
+
+    f->nr--;
+    if (i != f->nr) {
+        struct proc *last = f->heap[f->nr];
+        heap_set(f, i, last);
+        sift_down(f, i);
+        sift_up(f, last->se.heap_index);
+    }
+    p->se.heap_index = -1;
+}
+
+void fair_init_rq(struct fair_rq *f) {
+    static_assert(NPROC * sizeof(struct proc *) <= PGSIZE);
+    void *__pa pa = kallocpage();
+    assert(pa);
+    f->heap         = (struct proc **)PA_TO_KVA(pa);
+    f->nr           = 0;
+    f->min_vruntime = 0;
+    f->load         = 0;
+}
+
+void fair_init_entity(struct proc *p) {
+    struct sched_entity *se = &p->se;
+    se->vruntime              = 0;  // relative: starts at the min_vruntime of its first rq.
+    se->exec_start            = 0;
+    se->sum_exec_runtime      = 0;
+    se->prev_sum_exec_runtime = 0;
+    se->weight                = prio_to_weight[p->nice - NICE_MIN];
+    se->heap_index            = -1;
+    se->yielded               = 0;
+}
+
+static int is_fair(struct proc *p) {
+    return p != NULL && p->sched_class == &fair_sched_class;
+}
+
+static void update_min_vruntime(struct rq *rq) {
+    struct fair_rq *f  = &rq->fair;
+    struct proc *curr  = rq->curr;
+    uint64 vruntime    = f->min_vruntime;
+    int has            = 0;
+
+    if (is_fair(curr)) {
+        vruntime = curr->se.vruntime;
+        has      = 1;
+    }
+    if (f->nr > 0) {
+        struct proc *leftmost = f->heap[0];
+        if (!has || entity_before(leftmost, curr))
+            vruntime = leftmost->se.vruntime;
+        has = 1;
+    }
+    // min_vruntime never goes backwards.
+    if (has && (int64)(vruntime - f->min_vruntime) > 0)
+        f->min_vruntime = vruntime;
+}
+
+// charge the cpu time used by rq->curr since the last update.
+static void update_curr(struct rq *rq) {
+    struct proc *curr = rq->curr;
+    if (!is_fair(curr))
+        return;
+
+    struct sched_entity *se = &curr->se;
+    uint64 now              = r_time();
+    uint64 delta            = now - se->exec_start;
+    se->exec_start          = now;
+    se->sum_exec_runtime += delta;
+    se->vruntime += delta * NICE_0_WEIGHT / se->weight;
+
+    update_min_vruntime(rq);
+}
+
+// the wall-clock time slice p deserves in one SCHED_LATENCY period.
+static uint64 sched_slice(struct rq *rq, struct proc *p) {
+    uint64 slice = SCHED_LATENCY * p->se.weight / MAX(rq->fair.load, p->se.weight);
+    return MAX(slice, SCHED_MIN_GRANULARITY);
+}
+
+static void enqueue_fair(struct rq *rq, struct proc *p) {
+    struct fair_rq *f       = &rq->fair;
+    struct sched_entity *se = &p->se;
+
+    update_curr(rq);
+
+    // re-base the relative vruntime on this rq.
+    //  A process that slept for long gets at most half a latency of credit,
+    //  so that it runs soon, but cannot monopolize the cpu.
+    int64 lag = (int64)se->vruntime;
+    if (lag < -(int64)(SCHED_LATENCY / 2))
+        lag = -(int64)(SCHED_LATENCY / 2);
+    se->vruntime = f->min_vruntime + lag;
+
+    heap_insert(f, p);
+    f->load += se->weight;
+
+    // preempt curr if the new process is far behind it.
+    struct proc *curr = rq->curr;
+    if (is_fair(curr) && (int64)(curr->se.vruntime - se->vruntime) > (int64)SCHED_WAKEUP_GRAN)
+        rq->need_resched = 1;
+}
+
+static void dequeue_fair(struct rq *rq, struct proc *p) {
+    struct fair_rq *f = &rq->fair;
+
+    update_curr(rq);
+    heap_remove(f, p);
+    f->load -= p->se.weight;
+    p->se.vruntime -= f->min_vruntime;
+    update_min_vruntime(rq);
+}
+
+static struct proc *pick_next_fair(struct rq *rq) {
+    struct fair_rq *f = &rq->fair;
+    if (f->nr == 0)
+        return NULL;
+
+    struct proc *p = f->heap[0];
+    if (p->se.yielded && f->nr > 1) {
+        // p has yielded, give the next one a chance.
+        struct proc *next = f->heap[1];
+        if (f->nr > 2 && entity_before(f->heap[2], next))
+            next = f->heap[2];
+        p->se.yielded = 0;
+        p             = next;
+    }
+    p->se.yielded = 0;
+
+    heap_remove(f, p);
+    p->se.exec_start            = r_time();
+    p->se.prev_sum_exec_runtime = p->se.sum_exec_runtime;
+    return p;
+}
+
+static void put_prev_fair(struct rq *rq, struct proc *p) {
+    struct fair_rq *f = &rq->fair;
+    assert(rq->curr == p);
+
+    update_curr(rq);
+    f->load -= p->se.weight;
+    p->se.vruntime -= f->min_vruntime;
+}
+
+static void tick_fair(struct rq *rq, struct proc *curr) {
+    struct fair_rq *f = &rq->fair;
+
+    update_curr(rq);
+    if (f->nr == 0)
+        return;
+
+    uint64 ideal   = sched_slice(rq, curr);
+    uint64 ran     = curr->se.sum_exec_runtime - curr->se.prev_sum_exec_runtime;
+    if (ran > ideal) {
+        rq->need_resched = 1;
+        return;
+    }
+    if (ran < SCHED_MIN_GRANULARITY)
+        return;
+    // curr is too far ahead of the leftmost.
+    if ((int64)(curr->se.vruntime - f->heap[0]->se.vruntime) > (int64)ideal)
+        rq->need_resched = 1;
+}
+
+static struct proc *steal_fair(struct rq *rq, int dst_cpu) {
+    struct fair_rq *f = &rq->fair;
+    // from the leaves of the heap: the least likely to run soon here.
+    for (int i = f->nr - 1; i >= 0; i--) {
+        struct proc *p = f->heap[i];
+        if (p->cpus_allowed & (1UL << dst_cpu)) {
+            dequeue_fair(rq, p);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Change the weight of p. rq is the rq p is queued or running on, or NULL.
+void fair_reweight(struct rq *rq, struct proc *p, int nice) {
+    struct sched_entity *se = &p->se;
+    uint64 weight           = prio_to_weight[nice - NICE_MIN];
+
+    if (rq != NULL) {
+        update_curr(rq);
+        rq->fair.load -= se->weight;
+        rq->fair.load += weight;
+    }
+    se->weight = weight;
+    p->nice    = nice;
+}
+
+const struct sched_class fair_sched_class = {
+    .name      = "fair",
+    .next      = NULL,
+    .enqueue   = enqueue_fair,
+    .dequeue   = dequeue_fair,
+    .pick_next = pick_next_fair,
+    .put_prev  = put_prev_fair,
+    .tick      = tick_fair,
+    .steal     = steal_fair,
+};
@@ -2,6 +2,7 @@
 
 #include "console.h"
 #include "defs.h"
+#include "futex.h"
 #include "ktest/ktest.h"
 #include "loader.h"
 #include "timer.h"
@@ -11,26 +12,31 @@ int64 sys_fork() {
     return fork();
 }
 
-int64 sys_exec(uint64 __user path, uint64 __user argv) {
-    int ret;
-    char *kpath = kalloc(&kstrbuf);
-    char *arg[MAXARG];
-    memset(kpath, 0, KSTRING_MAX);
-    memset(arg, 0, sizeof(arg));
+int64 sys_vfork() {
+    return vfork();
+}
+
+int64 sys_clone(uint64 __user entry, uint64 arg, uint64 __user stack, uint64 tls) {
+    return clone(entry, arg, stack, tls);
+}
 
+// Copy the path and the NULL-terminated argv of exec() or spawn() from user space.
+//  kpath and arg[] are allocated from kstrbuf, release them with free_exec_args() even on failure.
+static int copy_exec_args(uint64 __user path, uint64 __user argv, char *kpath, char *arg[]) {
+    int ret = 0;
     struct proc *p = curr_proc();
 
     acquire(&p->lock);
-    acquire(&p->mm->lock);
+    read_lock(&p->mm->lock);
     release(&p->lock);
 
     if ((ret = copystr_from_user(p->mm, kpath, path, KSTRING_MAX)) < 0) {
-        goto free;
+        goto out;
     }
     for (int i = 0; i < MAXARG; i++) {
         uint64 useraddr;
         if ((ret = copy_from_user(p->mm, (char *)&useraddr, argv + i * sizeof(uint64), sizeof(uint64))) < 0) {
-            goto free;
+            goto out;
         }
         if (useraddr == 0) {
             arg[i] = 0;
@@ -39,30 +45,80 @@ int64 sys_exec(uint64 __user path, uint64 __user argv) {
         arg[i] = kalloc(&kstrbuf);
         assert(arg[i] != NULL);
         if ((ret = copystr_from_user(p->mm, arg[i], useraddr, KSTRING_MAX)) < 0) {
-            goto free;
+            goto out;
         }
     }
-    release(&p->mm->lock);
 
-    debugf("sys_exec %s\n", kpath);
-
-    ret = exec(kpath, arg);
+out:
+    read_unlock(&p->mm->lock);
+    return ret;
+}
 
+static void free_exec_args(char *kpath, char *arg[]) {
     kfree(&kstrbuf, kpath);
     for (int i = 0; arg[i]; i++) {
         kfree(&kstrbuf, arg[i]);
     }
+}
+
+int64 sys_exec(uint64 __user path, uint64 __user argv) {
+    int ret;
+    char *kpath = kalloc(&kstrbuf);
+    char *arg[MAXARG];
+    memset(kpath, 0, KSTRING_MAX);
+    memset(arg, 0, sizeof(arg));
+
+    if ((ret = copy_exec_args(path, argv, kpath, arg)) >= 0) {
+        debugf("sys_exec %s\n", kpath);
+        ret = exec(kpath, arg);
+    }
+
+    free_exec_args(kpath, arg);
     return ret;
+}
 
-free:
-    release(&p->mm->lock);
-    kfree(&kstrbuf, kpath);
-    for (int i = 0; arg[i]; i++) {
-        kfree(&kstrbuf, arg[i]);
+int64 sys_spawn(uint64 __user path, uint64 __user argv) {
+    int ret;
+    char *kpath = kalloc(&kstrbuf);
+    char *arg[MAXARG];
+    memset(kpath, 0, KSTRING_MAX);
+    memset(arg, 0, sizeof(arg));
+
+    if ((ret = copy_exec_args(path, argv, kpath, arg)) >= 0) {
+        debugf("sys_spawn %s\n", kpath);
+        ret = spawn(kpath, arg);
     }
+
+    free_exec_args(kpath, arg);
     return ret;
 }
 
+int64 sys_futex_wait(uint64 __user uaddr, int val, uint64 __user timeout) {
+    uint64 cycles = 0;
+    if (timeout != 0) {
+        struct proc *p = curr_proc();
+        TimeSpec ts;
+        int ret;
+
+        acquire(&p->lock);
+        read_lock(&p->mm->lock);
+        release(&p->lock);
+        ret = copy_from_user(p->mm, (char *)&ts, timeout, sizeof(ts));
+        read_unlock(&p->mm->lock);
+        if (ret < 0)
+            return ret;
+        if (ts.nsec >= 1000000000)
+            return -EINVAL;
+        // a zero timeout still times out at once.
+        cycles = MAX(timespec_to_cycles(&ts), 1);
+    }
+    return futex_wait(uaddr, val, cycles);
+}
+
+int64 sys_futex_wake(uint64 __user uaddr, int nr) {
+    return futex_wake(uaddr, nr);
+}
+
 int64 sys_exit(int code) {
     exit(code);
     panic_never_reach();
@@ -102,36 +158,148 @@ int64 sys_kill(int pid) {
 }
 
 int64 sys_sleep(int64 n) {
+    if (n <= 0)
+        return 0;
+    if (do_nanosleep(n * TICK_CYCLES) != 0)
+        return -1;
+    return 0;
+}
+
+int64 sys_nanosleep(uint64 __user req, uint64 __user rem) {
     struct proc *p = curr_proc();
+    TimeSpec ts;
+    int ret;
 
-    acquire(&tickslock);
-    uint64 ticks0 = ticks;
-    while (ticks - ticks0 < n) {
-        if (iskilled(p)) {
-            release(&tickslock);
-            return -1;
-        }
-        sleep(&ticks, &tickslock);
+    acquire(&p->lock);
+    read_lock(&p->mm->lock);
+    release(&p->lock);
+    ret = copy_from_user(p->mm, (char *)&ts, req, sizeof(ts));
+    read_unlock(&p->mm->lock);
+    if (ret < 0)
+        return ret;
+    if (ts.nsec >= 1000000000)
+        return -EINVAL;
+
+    uint64 left = do_nanosleep(timespec_to_cycles(&ts));
+    if (left == 0)
+        return 0;
+
+    // killed: report the remaining time.
+    if (rem != 0) {
+        cycles_to_timespec(left, &ts);
+        acquire(&p->lock);
+        read_lock(&p->mm->lock);
+        release(&p->lock);
+        copy_to_user(p->mm, rem, (char *)&ts, sizeof(ts));
+        read_unlock(&p->mm->lock);
     }
-    release(&tickslock);
-    return 0;
+    return -EINTR;
+}
+
+int64 sys_gettimeofday(uint64 __user tv, uint64 __user tz) {
+    struct proc *p = curr_proc();
+    uint64 cycles  = get_cycle();
+    TimeVal val;
+    int ret;
+
+    val.sec  = cycles / CPU_FREQ;
+    val.usec = (cycles % CPU_FREQ) * 1000 / (CPU_FREQ / 1000);
+
+    acquire(&p->lock);
+    read_lock(&p->mm->lock);
+    release(&p->lock);
+    ret = copy_to_user(p->mm, tv, (char *)&val, sizeof(val));
+    read_unlock(&p->mm->lock);
+    return ret < 0 ? ret : 0;
 }
 
 int64 sys_yield() {
-    yield();
+    sched_yield();
     return 0;
 }
 
+int64 sys_setnice(int pid, int nice) {
+    struct proc *p;
+
+    if (pid == 0) {
+        p = curr_proc();
+        acquire(&p->lock);
+    } else if ((p = pid_lookup(pid)) == NULL) {
+        return -ENOENT;
+    }
+    int ret = sched_setnice(p, nice);
+    release(&p->lock);
+    return ret;
+}
+
+int64 sys_sched_setaffinity(int pid, uint64 mask) {
+    struct proc *p;
+    struct proc *curr = curr_proc();
+
+    if (pid == 0) {
+        p = curr;
+        acquire(&p->lock);
+    } else if ((p = pid_lookup(pid)) == NULL) {
+        return -ENOENT;
+    }
+    int ret = sched_setaffinity(p, mask);
+    release(&p->lock);
+
+    // move off this cpu now if we are no longer allowed here.
+    if (ret == 0 && p == curr && !(mask & (1UL << cpuid())))
+        yield();
+    return ret;
+}
+
+int64 sys_sched_getaffinity(int pid) {
+    struct proc *p;
+
+    if (pid == 0) {
+        p = curr_proc();
+        acquire(&p->lock);
+    } else if ((p = pid_lookup(pid)) == NULL) {
+        return -ENOENT;
+    }
+    uint64 mask = p->cpus_allowed;
+    release(&p->lock);
+    return mask;
+}
+
+int64 sys_sched_setattr(uint64 __user attr) {
+    struct proc *p = curr_proc();
+    struct sched_attr sa;
+    int ret;
+
+    acquire(&p->lock);
+    read_lock(&p->mm->lock);
+    release(&p->lock);
+    ret = copy_from_user(p->mm, (char *)&sa, attr, sizeof(sa));
+    read_unlock(&p->mm->lock);
+    if (ret < 0)
+        return ret;
+
+    // ns to cycles, rounded up.
+    uint64 runtime  = (sa.runtime * (CPU_FREQ / 1000) + 999999) / 1000000;
+    uint64 deadline = (sa.deadline * (CPU_FREQ / 1000) + 999999) / 1000000;
+    uint64 period   = (sa.period * (CPU_FREQ / 1000) + 999999) / 1000000;
+    return sched_setattr(p, runtime, deadline, period);
+}
+
+int64 sys_sched_isolate(uint64 mask) {
+    return sched_isolate(mask);
+}
+
 int64 sys_sbrk(int64 n) {
     int64 ret;
     struct proc *p = curr_proc();
 
     acquire(&p->lock);
-    acquire(&p->mm->lock);
+    write_lock(&p->mm->lock);
 
-    struct vma *vma_brk = p->vma_brk;
-    int64 old_brk       = p->brk;
-    int64 new_brk       = (int64)p->brk + n;
+    struct mm *mm       = p->mm;
+    struct vma *vma_brk = mm->vma_brk;
+    int64 old_brk       = mm->brk;
+    int64 new_brk       = (int64)mm->brk + n;
 
     if (new_brk < vma_brk->vm_start) {
         warnf("userprog requested to shrink brk, but underflow.");
@@ -144,11 +312,11 @@ int64 sys_sbrk(int64 n) {
             ret = mm_remap(vma_brk, vma_brk->vm_start, roundup, vma_brk->pte_flags);
         }
         if (ret == 0) {
-            p->brk = new_brk;
+            mm->brk = new_brk;
         }
     }
 
-    release(&p->mm->lock);
+    write_unlock(&p->mm->lock);
     release(&p->lock);
 
     if (ret == 0) {
@@ -182,6 +350,21 @@ void syscall() {
         case SYS_exec:
             ret = sys_exec(args[0], args[1]);
             break;
+        case SYS_spawn:
+            ret = sys_spawn(args[0], args[1]);
+            break;
+        case SYS_vfork:
+            ret = sys_vfork();
+            break;
+        case SYS_clone:
+            ret = sys_clone(args[0], args[1], args[2], args[3]);
+            break;
+        case SYS_futex_wait:
+            ret = sys_futex_wait(args[0], args[1], args[2]);
+            break;
+        case SYS_futex_wake:
+            ret = sys_futex_wake(args[0], args[1]);
+            break;
         case SYS_exit:
             sys_exit(args[0]);
             panic_never_reach();
@@ -200,9 +383,27 @@ void syscall() {
         case SYS_sleep:
             ret = sys_sleep(args[0]);
             break;
+        case SYS_nanosleep:
+            ret = sys_nanosleep(args[0], args[1]);
+            break;
         case SYS_yield:
             ret = sys_yield();
             break;
+        case SYS_setnice:
+            ret = sys_setnice(args[0], args[1]);
+            break;
+        case SYS_sched_setaffinity:
+            ret = sys_sched_setaffinity(args[0], args[1]);
+            break;
+        case SYS_sched_getaffinity:
+            ret = sys_sched_getaffinity(args[0]);
+            break;
+        case SYS_sched_setattr:
+            ret = sys_sched_setattr(args[0]);
+            break;
+        case SYS_sched_isolate:
+            ret = sys_sched_isolate(args[0]);
+            break;
         case SYS_sbrk:
             ret = sys_sbrk(args[0]);
             break;
@@ -215,6 +416,9 @@ void syscall() {
         case SYS_write:
             ret = sys_write(args[0], args[1], args[2]);
             break;
+        case SYS_gettimeofday:
+            ret = sys_gettimeofday(args[0], args[1]);
+            break;
         case SYS_ktest:
             ret = ktest_syscall(args);
             break;
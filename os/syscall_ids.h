@@ -8,9 +8,17 @@
 #define SYS_getpid  5
 #define SYS_getppid 6
 #define SYS_kill    7
+#define SYS_spawn   8
+#define SYS_vfork   9
 
 #define SYS_sleep 10
 #define SYS_yield 11
+#define SYS_setnice 12
+#define SYS_nanosleep 13
+#define SYS_sched_setaffinity 14
+#define SYS_sched_getaffinity 15
+#define SYS_sched_setattr 16
+#define SYS_sched_isolate 17
 
 #define SYS_sbrk 20
 #define SYS_mmap 21
@@ -20,4 +28,8 @@
 
 #define SYS_gettimeofday 24
 
+#define SYS_clone 30
+#define SYS_futex_wait 31
+#define SYS_futex_wake 32
+
 #define SYS_ktest 99
\ No newline at end of file
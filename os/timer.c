@@ -1,10 +1,37 @@
 #include "timer.h"
 
+#include "defs.h"
 #include "riscv.h"
 #include "sbi.h"
 
 extern int on_vf2_board;
 
+// Per-cpu hierarchical timer wheel.
+//
+// Time is measured in units of TW_UNIT cycles. Level 0 has one slot per unit
+//  for the next 64 units, level 1 has one slot per 64 units for the next 64*64 units, and so on.
+// A timer is put into the lowest level that covers its expiry, and moves down a level
+//  (cascades) when the wheel reaches the slot it sits in. So adding and cancelling a timer is O(1),
+//  and each timer interrupt only looks at the timers due.
+#define TW_UNIT_SHIFT (7)  // 128 cycles, ~10us on QEMU
+#define TW_LEVELS     (4)
+#define TW_BITS       (6)
+#define TW_SLOTS      (1 << TW_BITS)
+#define TW_MASK       (TW_SLOTS - 1)
+#define TW_MAX_DELTA  ((1UL << (TW_LEVELS * TW_BITS)) - 1)
+
+struct timer_base {
+    spinlock_t lock;
+    uint64 clk;                // the next unit to process
+    uint64 next_expiry;        // in cycles, earliest pending timer, or -1. may be earlier than the actual.
+    uint64 next_tick;          // in cycles, the next periodic tick, or -1 if the tick is stopped.
+    int nr_pending;            // timers in the wheel
+    struct ktimer *running;    // the timer whose callback is running
+    struct list_head wheel[TW_LEVELS][TW_SLOTS];
+};
+
+static struct timer_base timer_bases[NCPU];
+
 /// read the `mtime` regiser
 uint64 get_cycle() {
     return r_time();
@@ -12,17 +39,305 @@ uint64 get_cycle() {
 
 /// Enable timer interrupt
 void timer_init() {
+    struct timer_base *base = &timer_bases[cpuid()];
+    spinlock_init(&base->lock, "timer");
+    base->clk         = get_cycle() >> TW_UNIT_SHIFT;
+    base->next_expiry = -1;
+    base->nr_pending  = 0;
+    base->running     = NULL;
+    for (int l = 0; l < TW_LEVELS; l++)
+        for (int i = 0; i < TW_SLOTS; i++)
+            list_init(&base->wheel[l][i]);
+
     // Enable supervisor timer interrupt
     w_sie(r_sie() | SIE_STIE);
     set_next_timer();
 }
 
+static void program_timer(uint64 stime) {
+    if (on_vf2_board) {
+        set_timer(stime);
+    } else {
+        w_stimecmp(stime);
+    }
+}
+
+// program the next timer interrupt of this cpu: the next tick or the earliest timer.
+static void reprogram(struct timer_base *base) {
+    program_timer(MIN(base->next_tick, base->next_expiry));
+}
+
 // /// Set the next timer interrupt
+//  (re)start the periodic tick.
 void set_next_timer() {
-    const uint64 timebase = CPU_FREQ / TICKS_PER_SEC;
-    if (on_vf2_board) {
-        set_timer(get_cycle() + timebase);
+    push_off();
+    struct timer_base *base = &timer_bases[cpuid()];
+    acquire(&base->lock);
+    base->next_tick = get_cycle() + TICK_CYCLES;
+    reprogram(base);
+    release(&base->lock);
+    pop_off();
+}
+
+/// Stop the periodic tick on an idle cpu.
+///  The timer only fires for the pending kernel timers.
+void stop_tick() {
+    push_off();
+    struct timer_base *base = &timer_bases[cpuid()];
+    acquire(&base->lock);
+    base->next_tick = -1;
+    reprogram(base);
+    release(&base->lock);
+    pop_off();
+}
+
+static inline uint64 expires_unit(struct ktimer *t) {
+    // round up, a timer never fires early.
+    return (t->expires + (1UL << TW_UNIT_SHIFT) - 1) >> TW_UNIT_SHIFT;
+}
+
+static void enqueue_timer(struct timer_base *base, struct ktimer *t) {
+    uint64 expires = expires_unit(t);
+    int64 delta    = expires - base->clk;
+    struct list_head *slot;
+
+    if (delta < 0) {
+        // already expired, run it at the next unit.
+        slot = &base->wheel[0][base->clk & TW_MASK];
     } else {
-        w_stimecmp(r_time() + timebase);
+        if (delta > TW_MAX_DELTA) {
+            // too far away: park it in the farthest slot, and re-enqueue it when it cascades.
+            expires = base->clk + TW_MAX_DELTA;
+            delta   = TW_MAX_DELTA;
+        }
+        int level = 0;
+        while (level < TW_LEVELS - 1 && delta >= (1L << ((level + 1) * TW_BITS)))
+            level++;
+        slot = &base->wheel[level][(expires >> (level * TW_BITS)) & TW_MASK];
+    }
+    list_add_tail(&t->link, slot);
+}
+
+// move the timers in wheel[level][index] to lower levels.
+static void cascade(struct timer_base *base, int level, int index) {
+    struct list_head *slot = &base->wheel[level][index];
+    struct ktimer *t, *tmp;
+    list_for_each_entry_safe(t, tmp, slot, link) {
+        list_del(&t->link);
+        enqueue_timer(base, t);
+    }
+}
+
+// After a long idle period, walking the wheel unit by unit to now is too slow:
+//  take out every timer and put it in again relative to now.
+static void rebucket(struct timer_base *base, uint64 now) {
+    struct list_head all;
+    struct ktimer *t, *tmp;
+
+    list_init(&all);
+    for (int l = 0; l < TW_LEVELS; l++) {
+        for (int i = 0; i < TW_SLOTS; i++) {
+            list_for_each_entry_safe(t, tmp, &base->wheel[l][i], link) {
+                list_del(&t->link);
+                list_add_tail(&t->link, &all);
+            }
+        }
+    }
+    base->clk = now;
+    list_for_each_entry_safe(t, tmp, &all, link) {
+        list_del(&t->link);
+        enqueue_timer(base, t);
     }
-}
\ No newline at end of file
+}
+
+// the earliest expiry among the pending timers, in cycles, or -1.
+//  Within a level, slots expire in order from clk, so only the first non-empty slot of each level matters.
+//  But levels overlap: a timer added long ago to level 1 may expire before one added lately to level 0,
+//  so take the earliest over all levels.
+static uint64 find_next_expiry(struct timer_base *base) {
+    if (base->nr_pending == 0)
+        return -1;
+    uint64 earliest = -1;
+    for (int l = 0; l < TW_LEVELS; l++) {
+        uint64 pos = base->clk >> (l * TW_BITS);
+        for (int i = 0; i < TW_SLOTS; i++) {
+            struct list_head *slot = &base->wheel[l][(pos + i) & TW_MASK];
+            if (list_empty(slot))
+                continue;
+            struct ktimer *t;
+            list_for_each_entry(t, slot, link) {
+                earliest = MIN(earliest, expires_unit(t));
+            }
+            break;
+        }
+    }
+    if (earliest == (uint64)-1)
+        panic("timer: %d pending timers not found", base->nr_pending);
+    return earliest << TW_UNIT_SHIFT;
+}
+
+// run the timers expired on this cpu.
+static void run_timers(struct timer_base *base) {
+    uint64 now = get_cycle() >> TW_UNIT_SHIFT;
+
+    assert(holding(&base->lock));
+    if (base->nr_pending == 0) {
+        base->clk = now + 1;
+        return;
+    }
+    if ((int64)(now - base->clk) >= TW_SLOTS * TW_SLOTS)
+        rebucket(base, now);
+
+    while ((int64)(now - base->clk) >= 0) {
+        int index = base->clk & TW_MASK;
+        // entering a new slot of level l+1 when level l wraps around.
+        for (int l = 1, idx = index; l < TW_LEVELS && idx == 0; l++) {
+            idx = (base->clk >> (l * TW_BITS)) & TW_MASK;
+            cascade(base, l, idx);
+        }
+
+        struct list_head *slot = &base->wheel[0][index];
+        while (!list_empty(slot)) {
+            struct ktimer *t = list_first_entry(slot, struct ktimer, link);
+            list_del(&t->link);
+            t->base = NULL;
+            base->nr_pending--;
+
+            // the callback may add timers again, drop the lock.
+            base->running = t;
+            release(&base->lock);
+            t->fn(t);
+            acquire(&base->lock);
+            base->running = NULL;
+        }
+        base->clk++;
+    }
+}
+
+/// Called on a timer interrupt.
+///  Runs the expired timers, returns 1 if the periodic tick is due.
+int timer_interrupt() {
+    struct timer_base *base = &timer_bases[cpuid()];
+    int tick                = 0;
+
+    acquire(&base->lock);
+    run_timers(base);
+    base->next_expiry = find_next_expiry(base);
+    if (base->next_tick != -1 && get_cycle() >= base->next_tick) {
+        base->next_tick = get_cycle() + TICK_CYCLES;
+        tick            = 1;
+    }
+    reprogram(base);
+    release(&base->lock);
+    return tick;
+}
+
+void ktimer_init(struct ktimer *t, void (*fn)(struct ktimer *t)) {
+    t->expires = 0;
+    t->fn      = fn;
+    t->base    = NULL;
+    list_init(&t->link);
+}
+
+/// Add a timer on this cpu, to fire at cycle `expires`.
+void ktimer_add(struct ktimer *t, uint64 expires) {
+    push_off();
+    struct timer_base *base = &timer_bases[cpuid()];
+    acquire(&base->lock);
+    assert(t->base == NULL);
+
+    if (base->nr_pending == 0)
+        base->clk = get_cycle() >> TW_UNIT_SHIFT;
+    t->expires = expires;
+    t->base    = base;
+    enqueue_timer(base, t);
+    base->nr_pending++;
+
+    uint64 fire = expires_unit(t) << TW_UNIT_SHIFT;
+    if (fire < base->next_expiry) {
+        base->next_expiry = fire;
+        reprogram(base);
+    }
+    release(&base->lock);
+    pop_off();
+}
+
+/// Cancel a timer. If its callback is running, wait for it to finish.
+///  Returns 1 if the timer was pending.
+///  Must not be called from the callback itself.
+int ktimer_cancel(struct ktimer *t) {
+    struct timer_base *base;
+
+    for (;;) {
+        base = __atomic_load_n(&t->base, __ATOMIC_ACQUIRE);
+        if (base == NULL)
+            break;
+        acquire(&base->lock);
+        if (t->base == base) {
+            list_del(&t->link);
+            t->base = NULL;
+            base->nr_pending--;
+            // leave next_expiry as it is, the interrupt finds nothing to run.
+            release(&base->lock);
+            return 1;
+        }
+        // the timer has fired, or has been re-added on another cpu.
+        release(&base->lock);
+    }
+
+    // the timer is not pending, but its callback may still be running on some cpu.
+    for (int i = 0; i < NCPU; i++) {
+        base = &timer_bases[i];
+        while (__atomic_load_n(&base->running, __ATOMIC_ACQUIRE) == t)
+            cpu_relax();
+    }
+    return 0;
+}
+
+uint64 timespec_to_cycles(TimeSpec *ts) {
+    // round up.
+    return ts->sec * CPU_FREQ + (ts->nsec * (CPU_FREQ / 1000) + 999999) / 1000000;
+}
+
+void cycles_to_timespec(uint64 cycles, TimeSpec *ts) {
+    ts->sec  = cycles / CPU_FREQ;
+    ts->nsec = (cycles % CPU_FREQ) * 1000000 / (CPU_FREQ / 1000);
+}
+
+struct sleep_timer {
+    struct ktimer timer;
+    spinlock_t lock;
+    int expired;
+};
+
+static void sleep_timer_fn(struct ktimer *t) {
+    struct sleep_timer *st = container_of(t, struct sleep_timer, timer);
+    acquire(&st->lock);
+    st->expired = 1;
+    wakeup(st);
+    release(&st->lock);
+}
+
+/// Sleep for `cycles`.
+///  Returns 0, or the remaining cycles if killed.
+int64 do_nanosleep(uint64 cycles) {
+    struct proc *p = curr_proc();
+    struct sleep_timer st;
+    uint64 deadline = get_cycle() + cycles;
+
+    ktimer_init(&st.timer, sleep_timer_fn);
+    spinlock_init(&st.lock, "sleep-timer");
+    st.expired = 0;
+
+    acquire(&st.lock);
+    ktimer_add(&st.timer, deadline);
+    while (!st.expired && !iskilled(p))
+        sleep(&st, &st.lock);
+    release(&st.lock);
+
+    // st is on our stack, make sure the callback is done with it.
+    ktimer_cancel(&st.timer);
+
+    uint64 now = get_cycle();
+    return now >= deadline ? 0 : deadline - now;
+}
@@ -1,19 +1,46 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include "list.h"
 #include "types.h"
 
 #define TICKS_PER_SEC (100)
 // QEMU
 #define CPU_FREQ (12500000)
+#define TICK_CYCLES   (CPU_FREQ / TICKS_PER_SEC)
 
 uint64 get_cycle();
 void timer_init();
 void set_next_timer();
+void stop_tick();
+int timer_interrupt();
 
 typedef struct {
     uint64 sec;   // 自 Unix 纪元起的秒数
     uint64 usec;  // 微秒数
 } TimeVal;
 
-#endif  // TIMER_H
\ No newline at end of file
+typedef struct {
+    uint64 sec;   // 秒数
+    uint64 nsec;  // 纳秒数
+} TimeSpec;
+
+// Kernel timer.
+//  fn is called once, in the timer interrupt of the cpu the timer is added on,
+//  after get_cycle() reaches expires. fn runs with interrupts off, and may add the timer again.
+struct ktimer {
+    uint64 expires;  // in cycles
+    void (*fn)(struct ktimer *t);
+    struct list_head link;     // link in a slot of the timer wheel
+    struct timer_base *base;   // the wheel this timer is pending on, NULL if not pending.
+};
+
+void ktimer_init(struct ktimer *t, void (*fn)(struct ktimer *t));
+void ktimer_add(struct ktimer *t, uint64 expires);
+int ktimer_cancel(struct ktimer *t);
+
+int64 do_nanosleep(uint64 cycles);
+uint64 timespec_to_cycles(TimeSpec *ts);
+void cycles_to_timespec(uint64 cycles, TimeSpec *ts);
+
+#endif  // TIMER_H
@@ -5,13 +5,14 @@
 #include "defs.h"
 #include "loader.h"
 #include "plic.h"
+#include "rcu.h"
 #include "syscall.h"
 #include "timer.h"
 
 static int64 kp_print_lock = 0;
 extern volatile int panicked;
 
-struct spinlock tickslock;
+seqlock_t tickslock;
 uint64 ticks;
 
 void plic_handle() {
@@ -25,23 +26,53 @@ void plic_handle() {
         plic_complete(irq);
 }
 
+// ticks follows the time register rather than counting interrupts,
+//  so that any hart can advance it, and an idle hart without a tick doesn't stop it.
+static void update_ticks(void) {
+    uint64 now = r_time() / TICK_CYCLES;
+    // racy read, most timer interrupts don't advance ticks.
+    if (now <= ticks)
+        return;
+    write_seqlock(&tickslock);
+    if (now > ticks)
+        ticks = now;
+    write_sequnlock(&tickslock);
+}
+
+// Read ticks without taking a lock, it is read far more often than it advances.
+uint64 get_ticks(void) {
+    uint64 t;
+    uint32 seq;
+    do {
+        seq = read_seqbegin(&tickslock);
+        t   = ticks;
+    } while (read_seqretry(&tickslock, seq));
+    return t;
+}
+
 static int handle_intr(void) {
     uint64 cause = r_scause();
     uint64 code  = cause & SCAUSE_EXCEPTION_CODE_MASK;
     if (code == SupervisorTimer) {
         tracef("time interrupt!");
-        if (cpuid() == 0) {
-            acquire(&tickslock);
-            ticks++;
-            wakeup(&ticks);
-            release(&tickslock);
+        mycpu()->nr_timer_intr++;
+        if (timer_interrupt()) {
+            update_ticks();
+            sched_tick();
+            rcu_check();
         }
-        set_next_timer();
         return 1;
     } else if (code == SupervisorExternal) {
         tracef("s-external interrupt from usertrap!");
         plic_handle();
         return 2;
+    } else if (code == SupervisorSoft) {
+        // an IPI from add_task(): wake up, restart the tick if it was stopped, or let usertrap act on need_resched.
+        tracef("s-software interrupt!");
+        w_sip(r_sip() & ~SIP_SSIP);
+        mycpu()->nr_ipi++;
+        sched_ipi();
+        return 3;
     } else {
         return 0;
     }
@@ -83,13 +114,26 @@ void kernel_trap(struct ktrapframe *ktf) {
 
     mycpu()->inkernel_trap--;
 
+    // full preemption: switch out the process we interrupted in the kernel, if it holds no lock.
+    //  Other traps taken meanwhile clobber sepc and sstatus, keep ours.
+    if (preempt_on_irq_return()) {
+        uint64 sepc    = r_sepc();
+        uint64 sstatus = r_sstatus();
+        mycpu()->nr_preempt++;
+        yield();
+        // we may be on another cpu now, whose FP registers are not ours to mark Dirty.
+        w_sepc(sepc);
+        w_sstatus((sstatus & ~SSTATUS_FS) | (r_sstatus() & SSTATUS_FS));
+    }
+
     return;
 
 kernel_panic:
     // lock against other cpu, to show a complete panic message.
     panicked = 1;
 
-    while (__sync_lock_test_and_set(&kp_print_lock, 1) != 0);
+    while (__sync_lock_test_and_set(&kp_print_lock, 1) != 0)
+        cpu_relax();
 
     errorf("=========== Kernel Panic ===========");
     print_sysregs(true);
@@ -108,7 +152,9 @@ void set_kerneltrap() {
 // set up to take exceptions and traps while in the kernel.
 void trap_init() {
     set_kerneltrap();
-    spinlock_init(&tickslock, "user-time");
+    seqlock_init(&tickslock, "user-time");
+    // IPIs from other harts
+    w_sie(r_sie() | SIE_SSIE);
 }
 
 // UserTrap begins
@@ -120,12 +166,12 @@ static void handle_pgfault(void) {
     struct mm *mm;
     pte_t *pte;
 
+    // faults only look up the page table, threads sharing mm take them in parallel.
     acquire(&p->lock);
     mm = p->mm;
-    acquire(&mm->lock);
+    read_lock(&mm->lock);
     release(&p->lock);
     pte = walk(mm, addr, 0);
-    release(&mm->lock);
 
     //	docs: Volume II: RISC-V Privileged Architectures V1.10, Page 61,
     //		> Two schemes to manage the A and D bits are permitted:
@@ -138,12 +184,13 @@ static void handle_pgfault(void) {
             // page fault possibly due to missing A/D bit
             // - Load/IF PageFault: Missing A bit
             // - Store PageFault  : Missing A/D bit
-            *pte |= PTE_A;
-            if (cause == StorePageFault)
-                *pte |= PTE_D;    
+            //  other readers may set them at the same time, hence the atomic or.
+            __atomic_fetch_or(pte, cause == StorePageFault ? PTE_A | PTE_D : PTE_A, __ATOMIC_RELAXED);
+            read_unlock(&mm->lock);
             return;
         }
     }
+    read_unlock(&mm->lock);
     // otherwise, it is a page fault due to invalid address
     infof("page fault in application, bad addr = %p, bad instruction = %p, core dumped.", r_stval(), p->trapframe->epc);
     setkilled(p, -2);
@@ -160,6 +207,7 @@ static void unknown_trap(void) {
 // called from trampoline.S
 void usertrap() {
     set_kerneltrap();
+    rcu_eqs_exit();
 
     if (intr_get())
         panic("entered interrupts enabled");
@@ -190,6 +238,8 @@ void usertrap() {
         intr_off();
     } else if (cause == LoadPageFault || cause == StorePageFault || cause == InstructionPageFault) {
         handle_pgfault();
+    } else if (cause == IllegalInstruction && fpu_first_use(p)) {
+        // retry the FP instruction, with FP enabled.
     } else {
         unknown_trap();
     }
@@ -198,8 +248,8 @@ void usertrap() {
     if ((killed = iskilled(p)) != 0)
         exit(killed);
 
-    // if it's a timer intr, call yield to give up CPU.
-    if (which_dev == 1)
+    // if it's a timer intr or an IPI and the scheduler wants the cpu back, call yield to give up CPU.
+    if ((which_dev == 1 || which_dev == 3) && need_resched())
         yield();
 
     // prepare for return to user mode
@@ -232,6 +282,9 @@ void usertrapret() {
     x |= SSTATUS_SPIE;  // enable interrupts in user mode
     w_sstatus(x);
 
+    // enable FP for processes that use it, and load their FP registers if needed.
+    fpu_return_to_user(curr_proc());
+
     // tell trampoline.S the user page table to switch to.
     uint64 satp  = MAKE_SATP(KVA_TO_PA(curr_proc()->mm->pgt));
     uint64 stvec = (TRAMPOLINE + (uservec - trampoline)) & ~0x3;
@@ -241,5 +294,6 @@ void usertrapret() {
     // and switches to user mode with sret.
     uint64 fn = TRAMPOLINE + (userret - trampoline);
     tracef("return to user @%p, fn %p", trapframe->epc);
-    ((void (*)(uint64, uint64, uint64))fn)(TRAPFRAME, satp, stvec);
+    rcu_eqs_enter();
+    ((void (*)(uint64, uint64, uint64))fn)(TRAPFRAME_VA(curr_proc()->index), satp, stvec);
 }
\ No newline at end of file
@@ -56,7 +56,7 @@ struct ktrapframe {
  *
  * Used when we were in the user-mode, and we meet an Exception (including ecall) or Interrupt to get into the trap.
  *
- * This trapframe is stored in the special physical page, which is mapped to the same VA `TRAPFRAME`.
+ * This trapframe is stored in the special physical page, which is mapped to the VA `TRAPFRAME_VA(p->index)`.
  *
  */
 struct trapframe {
@@ -128,7 +128,9 @@ void trap_init();
 void kerneltrap(struct ktrapframe *ktf);
 void usertrapret();
 
+uint64 get_ticks(void);
+
 extern uint64 ticks;
-extern struct spinlock tickslock;
+extern struct seqlock tickslock;
 
 #endif  // TRAP_H
\ No newline at end of file
@@ -25,5 +25,9 @@ typedef long int64;
 #define EINVAL 2
 #define ECHILD 3
 #define ENOENT 4
+#define EINTR 5
+#define EAGAIN 6
+#define ETIMEDOUT 7
+#define EBUSY 8
 
 #endif  // TYPES_H
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "defs.h"
 #include "kalloc.h"
+#include "sbi.h"
 
 static allocator_t mm_allocator;
 static allocator_t vma_allocator;
@@ -24,7 +25,7 @@ void uvm_init() {
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *walk(struct mm *mm, uint64 va, int alloc) {
-    assert(holding(&mm->lock));
+    assert(alloc ? write_holding(&mm->lock) : rw_holding(&mm->lock));
 
     pagetable_t pagetable = mm->pgt;
 
@@ -38,11 +39,10 @@ pte_t *walk(struct mm *mm, uint64 va, int alloc) {
         } else {
             if (!alloc)
                 return 0;
-            void *pa = kallocpage();
+            void *pa = kallocpage_zeroed();
             if (!pa)
                 return 0;
             pagetable = (pagetable_t)PA_TO_KVA(pa);
-            memset(pagetable, 0, PGSIZE);
             *pte = PA2PTE(KVA_TO_PA(pagetable)) | PTE_V;
         }
     }
@@ -59,7 +59,7 @@ uint64 __pa walkaddr(struct mm *mm, uint64 va) {
     }
 
     assert_str(PGALIGNED(va), "unaligned va %p", va);
-    assert(holding(&mm->lock));
+    assert(rw_holding(&mm->lock));
 
     pte_t *pte;
     uint64 pa;
@@ -88,29 +88,40 @@ uint64 useraddr(struct mm *mm, uint64 va) {
 /**
  * @brief Create a new mm structure and a page table.
  *
- * Then map the trapframe and trampoline in the new mm.
+ * Then map the trapframe at tf_va and trampoline in the new mm.
  */
-struct mm *mm_create(struct trapframe *tf) {
+// The last reference to an mm is dropped on the exit() and exec() paths,
+//  where tearing down the whole address space would delay the parent's wait() or the new program.
+static void mm_free_work(struct work *w) {
+    struct mm *mm = container_of(w, struct mm, free_work);
+    write_lock(&mm->lock);
+    mm_free(mm);
+}
+
+struct mm *mm_create(struct trapframe *tf, uint64 tf_va) {
     struct mm *mm = kalloc(&mm_allocator);
     memset(mm, 0, sizeof(*mm));
-    spinlock_init(&mm->lock, "mm");
-    mm->vma    = NULL;
-    mm->refcnt = 1;
+    rwlock_init(&mm->lock, "mm");
+    mm->vma     = NULL;
+    mm->vma_brk = NULL;
+    mm->brk     = 0;
+    mm->refcnt  = 1;
+
+    work_init(&mm->free_work, mm_free_work);
 
-    void *pa = kallocpage();
+    void *pa = kallocpage_zeroed();
     if (!pa) {
         warnf("kallocpage failed for root page table");
         goto free_mm;
     }
     mm->pgt = (pagetable_t)PA_TO_KVA(pa);
-    memset(mm->pgt, 0, PGSIZE);
-    acquire(&mm->lock);
+    write_lock(&mm->lock);
 
     // map trapframe and trampoline in the new mm
     if (mm_mappageat(mm, TRAMPOLINE, KIVA_TO_PA(trampoline), PTE_A | PTE_R | PTE_X) < 0)
         goto free_mm;
 
-    if (mm_mappageat(mm, TRAPFRAME, KVA_TO_PA(tf), PTE_A | PTE_D | PTE_R | PTE_W))
+    if (mm_map_trapframe(mm, tf, tf_va) < 0)
         goto free_mm;
 
     return mm;
@@ -118,13 +129,13 @@ struct mm *mm_create(struct trapframe *tf) {
 free_mm:
     if (mm->pgt)
         kfreepage((void *)KVA_TO_PA(mm->pgt));
-    release(&mm->lock);
+    write_unlock(&mm->lock);
     kfree(&mm_allocator, mm);
     return NULL;
 }
 
 struct vma *mm_create_vma(struct mm *mm) {
-    assert(holding(&mm->lock));
+    assert(write_holding(&mm->lock));
 
     struct vma *vma = kalloc(&vma_allocator);
     memset(vma, 0, sizeof(*vma));
@@ -132,8 +143,10 @@ struct vma *mm_create_vma(struct mm *mm) {
     return vma;
 }
 
-static void freevma(struct vma *vma, int free_phy_page) {
-    assert(holding(&vma->owner->lock));
+// Unmap vma, and free its pages if free_phy_page.
+//  If private, no one else can reach the mm, and we may let others run in between.
+static void freevma(struct vma *vma, int free_phy_page, int private) {
+    assert(write_holding(&vma->owner->lock));
     assert(PGALIGNED(vma->vm_start) && PGALIGNED(vma->vm_end));
 
     struct mm *mm = vma->owner;
@@ -146,16 +159,19 @@ static void freevma(struct vma *vma, int free_phy_page) {
         } else {
             debugf("free unmapped address %p", va);
         }
+        if (private)
+            cond_resched_write_lock(&mm->lock);
     }
     sfence_vma();
 }
 
+// Free all VMAs of an mm no one else uses: a dying one, or one being built.
 void mm_free_vmas(struct mm *mm) {
-    assert(holding(&mm->lock));
+    assert(write_holding(&mm->lock));
 
     struct vma *next, *vma = mm->vma;
     while (vma) {
-        freevma(vma, true);
+        freevma(vma, true, true);
         next = vma->next;
         kfree(&vma_allocator, vma);
         vma = next;
@@ -176,22 +192,51 @@ static void freepgt(pagetable_t pgt) {
     kfreepage((void *)KVA_TO_PA(pgt));
 }
 
+/**
+ * @brief Map a process's trapframe in mm, at tf_va. Every process using mm has one.
+ */
+int mm_map_trapframe(struct mm *mm, struct trapframe *tf, uint64 tf_va) {
+    return mm_mappageat(mm, tf_va, KVA_TO_PA(tf), PTE_A | PTE_D | PTE_R | PTE_W);
+}
+
+/**
+ * @brief Drop a reference to mm, held by the process whose trapframe is mapped at tf_va.
+ *
+ * The last reference frees mm later, in the worker of this cpu. Caller write-locks mm->lock, which is released.
+ */
+void mm_put(struct mm *mm, uint64 tf_va) {
+    assert(write_holding(&mm->lock));
+
+    if (mm->refcnt == 1) {
+        // no one else can reach mm, and its trapframe mapping goes away with the page table.
+        write_unlock(&mm->lock);
+        queue_work(&mm->free_work);
+        return;
+    }
+    pte_t *pte = walk(mm, tf_va, 0);
+    assert(pte != NULL && (*pte & PTE_V));
+    *pte = 0;
+    sfence_vma();
+    mm->refcnt--;
+    write_unlock(&mm->lock);
+}
+
 /**
  * @brief Free the mm structure, including all VMAs and the page table.
  */
 void mm_free(struct mm *mm) {
-    assert(holding(&mm->lock));
+    assert(write_holding(&mm->lock));
     assert(mm->refcnt > 0);
 
     mm_free_vmas(mm);
     freepgt(mm->pgt);
 
-    release(&mm->lock);
+    write_unlock(&mm->lock);
     kfree(&mm_allocator, mm);
 }
 
 static int vma_check_overlap(struct mm *mm, uint64 start, uint64 end, struct vma *exclude) {
-    assert(holding(&mm->lock));
+    assert(rw_holding(&mm->lock));
 
     if (start == end)
         return 0;
@@ -226,7 +271,7 @@ int mm_mappages(struct vma *vma) {
     assert(PGALIGNED(vma->vm_end));
     assert((vma->pte_flags & PTE_R) || (vma->pte_flags & PTE_W) || (vma->pte_flags & PTE_X));
 
-    assert(holding(&vma->owner->lock));
+    assert(write_holding(&vma->owner->lock));
 
     if (vma_check_overlap(vma->owner, vma->vm_start, vma->vm_end, vma)) {
         errorf("overlap: [%p, %p)", vma->vm_start, vma->vm_end);
@@ -269,11 +314,28 @@ int mm_mappages(struct vma *vma) {
     return 0;
 
 bad:
-    freevma(vma, true);
+    freevma(vma, true, false);
     kfree(&vma_allocator, vma);
     return ret;
 }
 
+// Flush stale translations of mm after removing or downgrading mappings.
+//  A shared mm may be in use on other harts, flush their TLBs as well.
+static void mm_flush_tlb(struct mm *mm) {
+    sfence_vma();
+    if (mm->refcnt == 1)
+        return;
+
+    uint64 mask = 0;
+    for (int i = 0; i < NCPU; i++) {
+        struct cpu *c = getcpu(i);
+        if (c->online && i != cpuid())
+            mask |= 1UL << c->mhart_id;
+    }
+    if (mask)
+        sbi_remote_sfence_vma(mask);
+}
+
 // Remap a range of virtual address to a new range.
 // The new range must not overlap with any existing range.
 // Used in sbrk.
@@ -285,7 +347,7 @@ int mm_remap(struct vma *vma, uint64 start, uint64 end, uint64 pte_flags) {
 
     pte_t *pte;
     struct mm *mm = vma->owner;
-    assert(holding(&mm->lock));
+    assert(write_holding(&mm->lock));
 
     if (vma_check_overlap(mm, start, end, vma)) {
         errorf("overlap: [%p, %p)", start, end);
@@ -312,8 +374,8 @@ int mm_remap(struct vma *vma, uint64 start, uint64 end, uint64 pte_flags) {
                 uint64 pte_woflags = *pte & ~PTE_RWX;
                 *pte               = pte_woflags | pte_flags;
             } else {
-                // mapping does not exist, create it.
-                void *pa = kallocpage();
+                // mapping does not exist, create it. anonymous memory starts zeroed.
+                void *pa = kallocpage_zeroed();
                 if (!pa) {
                     errorf("kallocpage, va = %p", va);
                     goto err;
@@ -337,7 +399,7 @@ int mm_remap(struct vma *vma, uint64 start, uint64 end, uint64 pte_flags) {
             }
         }
     }
-    sfence_vma();
+    mm_flush_tlb(mm);
 
     vma->vm_start  = start;
     vma->vm_end    = end;
@@ -369,7 +431,7 @@ err:
 
 // Map a physical page to a virtual address.
 int mm_mappageat(struct mm *mm, uint64 va, uint64 __pa pa, uint64 flags) {
-    assert(holding(&mm->lock));
+    assert(write_holding(&mm->lock));
 
     if (!IS_USER_VA(va))
         panic("invalid user VA");
@@ -402,8 +464,8 @@ int mm_mappageat(struct mm *mm, uint64 va, uint64 __pa pa, uint64 flags) {
 // Copy the pagetable page and all the user pages.
 // Return 0 on success, negative on error.
 int mm_copy(struct mm *old, struct mm *new) {
-    assert(holding(&old->lock));
-    assert(holding(&new->lock));
+    assert(rw_holding(&old->lock));
+    assert(write_holding(&new->lock));
     struct vma *vma = old->vma;
 
     while (vma) {
@@ -433,7 +495,7 @@ err:
 }
 
 struct vma *mm_find_vma(struct mm *mm, uint64 va) {
-    assert(holding(&mm->lock));
+    assert(rw_holding(&mm->lock));
 
     struct vma *vma = mm->vma;
     while (vma) {
@@ -4,6 +4,7 @@
 #include "lock.h"
 #include "riscv.h"
 #include "types.h"
+#include "workqueue.h"
 
 #define __user
 #define __pa
@@ -38,11 +39,16 @@ struct vma {
     uint64 pte_flags;
 };
 struct mm {
-    spinlock_t lock;
+    // Read-locked to walk the page table or the vma list, and to access user memory.
+    //  Write-locked to change either, or any other field.
+    rwlock_t lock;
 
     pagetable_t __kva pgt;
     struct vma* vma;
-    int refcnt;
+    struct vma *vma_brk;    // special vma for heap, included in the vma list.
+    uint64 brk;             // end address of heap
+    int refcnt;             // processes using this mm, which all have a trapframe mapped in it.
+    struct work free_work;  // mm_free() deferred by mm_put()
 };
 
 // kvm.c
@@ -57,7 +63,9 @@ uint64 __pa walkaddr(struct mm* mm, uint64 va);
 uint64 useraddr(struct mm* mm, uint64 va);
 
 struct trapframe;
-struct mm *mm_create(struct trapframe* tf);
+struct mm *mm_create(struct trapframe* tf, uint64 tf_va);
+int mm_map_trapframe(struct mm *mm, struct trapframe *tf, uint64 tf_va);
+void mm_put(struct mm *mm, uint64 tf_va);
 struct vma* mm_create_vma(struct mm* mm);
 void mm_free_vmas(struct mm* mm);
 void mm_free(struct mm* mm);
@@ -0,0 +1,132 @@
+#include "waitqueue.h"
+
+#include "defs.h"
+
+// sleep() and wakeup() use a hashed table of wait queues keyed by the channel,
+//  so that a wakeup only looks at the processes sleeping on channels of the same bucket.
+#define WAIT_TABLE_BITS (6)
+#define WAIT_TABLE_SIZE (1 << WAIT_TABLE_BITS)
+
+static struct wait_queue wait_table[WAIT_TABLE_SIZE];
+
+static inline struct wait_queue *chan_wq(void *chan) {
+    // Fibonacci hashing: channels are addresses of kernel objects, whose low bits are mostly equal.
+    uint64 h = (uint64)chan * 0x9e3779b97f4a7c15UL;
+    return &wait_table[h >> (64 - WAIT_TABLE_BITS)];
+}
+
+void waitqueue_init() {
+    for (int i = 0; i < WAIT_TABLE_SIZE; i++)
+        wait_queue_init(&wait_table[i], "waittable");
+}
+
+void wait_queue_init(struct wait_queue *wq, char *name) {
+    spinlock_init(&wq->lock, name);
+    list_init(&wq->head);
+}
+
+// Atomically release lk and sleep on chan in wq.
+//  Reacquires lk when awakened.
+void wait_queue_sleep(struct wait_queue *wq, void *chan, spinlock_t *lk) {
+    struct proc *p = curr_proc();
+
+    acquire(&wq->lock);
+    p->sleep_chan = chan;
+    list_add_tail(&p->wq_link, &wq->head);
+
+    // Once we are on wq and hold p->lock, we can be
+    // guaranteed that we won't miss any wakeup
+    // (wakeup locks wq->lock, then p->lock),
+    // so it's okay to release lk.
+    acquire(&p->lock);
+    release(&wq->lock);
+    release(lk);
+
+    // Go to sleep.
+    p->state = SLEEPING;
+
+    sched();
+
+    release(&p->lock);
+
+    // p get waking up, Tidy up.
+    //  The waker has unlinked us, unless we were woken up by kill().
+    acquire(&wq->lock);
+    if (!list_empty(&p->wq_link))
+        list_del(&p->wq_link);
+    p->sleep_chan = NULL;
+    release(&wq->lock);
+
+    // Reacquire original lock.
+    acquire(lk);
+}
+
+// Wake up at most nr processes sleeping on chan in wq, all of them if nr < 0.
+//  Returns the number of processes woken up, in the order they went to sleep.
+// Must be called without any p->lock.
+int wait_queue_wake_nr(struct wait_queue *wq, void *chan, int nr) {
+    struct proc *p, *tmp;
+    int woken = 0;
+
+    acquire(&wq->lock);
+    list_for_each_entry_safe(p, tmp, &wq->head, wq_link) {
+        if (woken == nr)
+            break;
+        if (p->sleep_chan != chan)
+            continue;
+        acquire(&p->lock);
+        list_del(&p->wq_link);
+        if (p->state != SLEEPING) {
+            // a stale entry: already made RUNNABLE by kill() or a timeout, and not yet unlinked by itself.
+            //  It doesn't count, or a real sleeper would miss this wakeup.
+            release(&p->lock);
+            continue;
+        }
+        p->state       = RUNNABLE;
+        p->wakeup_time = r_time();
+        add_task(p);
+        release(&p->lock);
+        woken++;
+    }
+    release(&wq->lock);
+    return woken;
+}
+
+// Wake up p if it sleeps on wq, e.g. when its timeout fires, and unlink it,
+//  so that it isn't left on wq as a stale entry. Returns 1 if p was woken up.
+// Must be called without any p->lock.
+int wait_queue_wake_proc(struct wait_queue *wq, struct proc *p) {
+    int woken = 0;
+
+    acquire(&wq->lock);
+    acquire(&p->lock);
+    // a SLEEPING process is on the queue it sleeps on, which the caller knows to be wq.
+    if (p->state == SLEEPING) {
+        list_del(&p->wq_link);
+        p->state       = RUNNABLE;
+        p->wakeup_time = r_time();
+        add_task(p);
+        woken = 1;
+    }
+    release(&p->lock);
+    release(&wq->lock);
+    return woken;
+}
+
+// Wake up all processes sleeping on chan in wq.
+// Must be called without any p->lock.
+void wait_queue_wake(struct wait_queue *wq, void *chan) {
+    wait_queue_wake_nr(wq, chan, -1);
+}
+
+// Atomically release lock and sleep on chan.
+// Reacquires lock when awakened.
+void sleep(void *chan, spinlock_t *lk) {
+    wait_queue_sleep(chan_wq(chan), chan, lk);
+}
+
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void wakeup(void *chan) {
+    wait_queue_wake(chan_wq(chan), chan);
+}
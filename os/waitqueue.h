@@ -0,0 +1,26 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include "list.h"
+#include "lock.h"
+#include "types.h"
+
+struct proc;
+
+// A wait queue holds the processes sleeping on it, linked by p->wq_link.
+//  Sleepers record the channel they wait for in p->sleep_chan,
+//  so that several channels can share one queue.
+//  Lock order: the sleeper's lk -> wq->lock -> p->lock.
+struct wait_queue {
+    spinlock_t lock;
+    struct list_head head;
+};
+
+void waitqueue_init();
+void wait_queue_init(struct wait_queue *wq, char *name);
+void wait_queue_sleep(struct wait_queue *wq, void *chan, spinlock_t *lk);
+void wait_queue_wake(struct wait_queue *wq, void *chan);
+int wait_queue_wake_nr(struct wait_queue *wq, void *chan, int nr);
+int wait_queue_wake_proc(struct wait_queue *wq, struct proc *p);
+
+#endif  // WAITQUEUE_H
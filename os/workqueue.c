@@ -0,0 +1,133 @@
+#include "workqueue.h"
+
+#include "defs.h"
+#include "proc.h"
+#include "waitqueue.h"
+
+// Every cpu has a queue of pending work, run in order by its worker, a kernel thread bound to that cpu.
+//  The worker sleeps on the queue's own wait queue, so waking it up doesn't look at any other sleeper.
+//  Lock order: wq->lock -> wq->waitq.lock -> p->lock, as for any sleep().
+struct workqueue {
+    spinlock_t lock;
+    struct list_head head;     // pending work, oldest first
+    struct wait_queue waitq;   // the worker sleeps here when there is nothing to do
+    struct proc *worker;
+    int idle;         // the worker is sleeping on waitq, or about to
+    int busy;         // the worker is running a work
+    int nr_flushers;  // processes waiting in flush_workqueues()
+};
+
+static struct workqueue workqueues[NCPU];
+
+void work_init(struct work *w, void (*fn)(struct work *)) {
+    list_init(&w->link);
+    w->fn      = fn;
+    w->pending = 0;
+}
+
+// Initialize the queues at boot, before anyone queues work. Work queued before the workers start waits for them.
+void workqueue_init() {
+    for (int i = 0; i < NCPU; i++) {
+        struct workqueue *wq = &workqueues[i];
+        spinlock_init(&wq->lock, "workqueue");
+        list_init(&wq->head);
+        wait_queue_init(&wq->waitq, "worker");
+        wq->worker      = NULL;
+        wq->idle        = 0;
+        wq->busy        = 0;
+        wq->nr_flushers = 0;
+    }
+}
+
+static void worker_main(void *arg) {
+    struct workqueue *wq = arg;
+
+    acquire(&wq->lock);
+    for (;;) {
+        while (list_empty(&wq->head)) {
+            if (wq->nr_flushers)
+                wakeup(&wq->busy);
+            wq->idle = 1;
+            wait_queue_sleep(&wq->waitq, wq, &wq->lock);
+        }
+        struct work *w = list_first_entry(&wq->head, struct work, link);
+        list_del(&w->link);
+        w->pending = 0;
+        wq->busy   = 1;
+        release(&wq->lock);
+
+        // w may be freed by its fn, don't touch it afterwards.
+        w->fn(w);
+
+        // kernel code is not preempted, give way between works.
+        if (need_resched())
+            yield();
+
+        acquire(&wq->lock);
+        wq->busy = 0;
+    }
+}
+
+// Start the worker of this cpu. Called by each cpu before it enters the scheduler.
+void workqueue_start() {
+    int cpu              = cpuid();
+    struct workqueue *wq = &workqueues[cpu];
+
+    struct proc *p = kthread_create(worker_main, wq, 1UL << cpu);
+    if (p == NULL)
+        panic("cannot create the worker of cpu %d", cpu);
+    acquire(&wq->lock);
+    wq->worker = p;
+    release(&wq->lock);
+}
+
+// Queue w to run on the given cpu.
+//  Returns 1 if queued, or 0 if w was already pending. Safe to call from an interrupt handler.
+int queue_work_on(int cpu, struct work *w) {
+    struct workqueue *wq = &workqueues[cpu];
+    int wake             = 0;
+
+    acquire(&wq->lock);
+    if (w->pending) {
+        release(&wq->lock);
+        return 0;
+    }
+    w->pending = 1;
+    list_add_tail(&w->link, &wq->head);
+    if (wq->idle) {
+        wq->idle = 0;
+        wake     = 1;
+    }
+    release(&wq->lock);
+
+    // the worker is already on waitq, as it only releases wq->lock after joining it.
+    if (wake)
+        wait_queue_wake(&wq->waitq, wq);
+    return 1;
+}
+
+// Queue w to run on the current cpu.
+int queue_work(struct work *w) {
+    // don't move to another cpu before w is queued.
+    preempt_disable();
+    int ret = queue_work_on(cpuid(), w);
+    preempt_enable();
+    return ret;
+}
+
+// Wait until every work queued so far has finished, e.g. to count free pages after the deferred frees.
+//  Must not be called by a worker.
+void flush_workqueues() {
+    for (int i = 0; i < NCPU; i++) {
+        struct workqueue *wq = &workqueues[i];
+        acquire(&wq->lock);
+        assert(wq->worker == NULL || wq->worker != curr_proc());
+        // a cpu that never started its worker has nothing to wait for.
+        while (wq->worker != NULL && (!list_empty(&wq->head) || wq->busy)) {
+            wq->nr_flushers++;
+            sleep(&wq->busy, &wq->lock);
+            wq->nr_flushers--;
+        }
+        release(&wq->lock);
+    }
+}
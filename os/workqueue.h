@@ -0,0 +1,24 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "list.h"
+#include "types.h"
+
+// Deferred work, run later in process context by the worker kernel thread of a cpu.
+//  Work queued from an interrupt handler or a latency-sensitive path runs after it returns,
+//  and may sleep, take any lock, or take its time.
+struct work {
+    struct list_head link;  // link in the queue, protected by its lock
+    void (*fn)(struct work *);
+    int pending;  // queued and not started yet, protected by the queue's lock
+};
+
+void work_init(struct work *w, void (*fn)(struct work *));
+
+void workqueue_init();
+void workqueue_start();
+int queue_work(struct work *w);
+int queue_work_on(int cpu, struct work *w);
+void flush_workqueues();
+
+#endif  // WORKQUEUE_H
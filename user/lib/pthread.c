@@ -0,0 +1,63 @@
+#include "../../os/types.h"
+#include "user.h"
+
+// Threads are processes sharing our address space, created by clone().
+//  A thread is a child of the thread that created it, and only that one can join it.
+//  tp points to the thread's struct pthread, and is NULL in the main thread.
+
+#define THREAD_STACK_SIZE (16 * 1024)
+
+struct pthread {
+    void *(*start)(void *);
+    void *arg;
+    void *retval;
+    int tid;
+};
+
+static void thread_entry(struct pthread *t) {
+    pthread_exit(t->start(t->arg));
+}
+
+int pthread_create(pthread_t *thread, void *(*start)(void *), void *arg) {
+    // the struct pthread sits at the bottom of the thread's stack.
+    struct pthread *t = malloc(THREAD_STACK_SIZE);
+    if (t == NULL)
+        return -1;
+    t->start  = start;
+    t->arg    = arg;
+    t->retval = NULL;
+
+    uint64 sp = ((uint64)t + THREAD_STACK_SIZE) & ~15UL;
+    int tid   = clone(thread_entry, t, (void *)sp, t);
+    if (tid < 0) {
+        free(t);
+        return -1;
+    }
+    t->tid  = tid;
+    *thread = t;
+    return 0;
+}
+
+int pthread_join(pthread_t thread, void **retval) {
+    int code;
+    if (wait(thread->tid, &code) != thread->tid)
+        return -1;
+    // the thread has exited, its stack is free to go.
+    if (retval)
+        *retval = thread->retval;
+    free(thread);
+    return 0;
+}
+
+void pthread_exit(void *retval) {
+    pthread_t self = pthread_self();
+    if (self)
+        self->retval = retval;
+    exit(0);
+}
+
+pthread_t pthread_self(void) {
+    pthread_t t;
+    asm volatile("mv %0, tp" : "=r"(t));
+    return t;
+}
@@ -0,0 +1,74 @@
+#include "../../os/types.h"
+#include "user.h"
+
+// Mutex, condition variable and semaphore on futex_wait/futex_wake.
+//  The fast paths are a single atomic operation, the kernel is entered only to block or to wake up.
+//  The mutex follows "Futexes Are Tricky" by Ulrich Drepper.
+
+void mutex_lock(mutex_t *m) {
+    int c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    // contended: mark it so, the unlocker will wake us up.
+    if (c != 2)
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex_wait(&m->state, 2, NULL);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+int mutex_trylock(mutex_t *m) {
+    int c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_unlock(mutex_t *m) {
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex_wake(&m->state, 1);
+    }
+}
+
+// Callers re-check their condition, as a signal may wake up more than one waiter.
+void cond_wait(cond_t *c, mutex_t *m) {
+    int seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    mutex_unlock(m);
+    // returns at once if a signal came after we read seq.
+    futex_wait(&c->seq, seq, NULL);
+    mutex_lock(m);
+}
+
+void cond_signal(cond_t *c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 1);
+}
+
+void cond_broadcast(cond_t *c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 0x7fffffff);
+}
+
+void sem_init(sem_t *s, int count) {
+    s->count   = count;
+    s->waiters = 0;
+}
+
+void sem_wait(sem_t *s) {
+    for (;;) {
+        int c = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+        while (c > 0) {
+            if (__atomic_compare_exchange_n(&s->count, &c, c - 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return;
+        }
+        __atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        futex_wait(&s->count, 0, NULL);
+        __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void sem_post(sem_t *s) {
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&s->count, 1);
+}
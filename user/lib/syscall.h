@@ -7,6 +7,8 @@
 // we only put syscall prototypes here, usys.pl will generate the actual syscall entry code
 int fork();
 int exec(char *path, char *argv[]);
+int spawn(char *path, char *argv[]);
+int vfork();
 void __attribute__((noreturn)) exit(int status);
 void kill(int pid);
 int wait(int pid, int *status);
@@ -15,6 +17,41 @@ int getppid();
 
 int sleep(int ticks);
 void yield();
+int setnice(int pid, int nice);
+// mask: bit i allows running on hart i. pid 0 is the caller.
+int sched_setaffinity(int pid, uint64 mask);
+uint64 sched_getaffinity(int pid);
+
+// deadline scheduling of the caller, in ns: runtime every period, done within deadline of its start.
+//  runtime 0 returns to the fair class. Fails with -EBUSY if no hart has the bandwidth left.
+struct sched_attr {
+    uint64 runtime;
+    uint64 deadline;
+    uint64 period;
+};
+int sched_setattr(struct sched_attr *attr);
+// take the harts in mask out of general scheduling. Pinned processes run there without the tick.
+int sched_isolate(uint64 mask);
+
+typedef struct {
+    uint64 sec;
+    uint64 usec;
+} TimeVal;
+
+typedef struct {
+    uint64 sec;
+    uint64 nsec;
+} TimeSpec;
+
+int nanosleep(TimeSpec *req, TimeSpec *rem);
+
+// start a thread sharing our address space at entry(arg), on `stack` with tp = tls. see pthread.c
+int clone(void *entry, void *arg, void *stack, void *tls);
+
+// sleep while *addr == val, at most for timeout if not NULL. see sync.c
+int futex_wait(int *addr, int val, TimeSpec *timeout);
+int futex_wake(int *addr, int n);
+int gettimeofday(TimeVal *tv, void *tz);
 
 void *sbrk(int increment);
 
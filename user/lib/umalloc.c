@@ -1,5 +1,5 @@
 #include "../../os/types.h"
-#include "syscall.h"
+#include "user.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
@@ -18,8 +18,9 @@ typedef union header Header;
 
 static Header base;
 static Header *freep;
+static mutex_t malloc_lock;  // threads share the heap
 
-void free(void *ap) {
+static void __free(void *ap) {
     Header *bp, *p;
 
     bp = (Header *)ap - 1;
@@ -39,6 +40,12 @@ void free(void *ap) {
     freep = p;
 }
 
+void free(void *ap) {
+    mutex_lock(&malloc_lock);
+    __free(ap);
+    mutex_unlock(&malloc_lock);
+}
+
 static Header *morecore(uint nu) {
     char *p;
     Header *hp;
@@ -50,11 +57,11 @@ static Header *morecore(uint nu) {
         return 0;
     hp         = (Header *)p;
     hp->s.size = nu;
-    free((void *)(hp + 1));
+    __free((void *)(hp + 1));
     return freep;
 }
 
-void *malloc(uint nbytes) {
+static void *__malloc(uint nbytes) {
     Header *p, *prevp;
     uint nunits;
 
@@ -80,3 +87,10 @@ void *malloc(uint nbytes) {
                 return 0;
     }
 }
+
+void *malloc(uint nbytes) {
+    mutex_lock(&malloc_lock);
+    void *p = __malloc(nbytes);
+    mutex_unlock(&malloc_lock);
+    return p;
+}
@@ -28,6 +28,37 @@ void stdout_nobuf(void);
 void *malloc(uint);
 void free(void *);
 
+// pthread.c
+typedef struct pthread *pthread_t;
+int pthread_create(pthread_t *thread, void *(*start)(void *), void *arg);
+int pthread_join(pthread_t thread, void **retval);
+void __attribute__((noreturn)) pthread_exit(void *retval);
+pthread_t pthread_self(void);
+
+// sync.c, blocking primitives on futexes. zero-initialized ones are ready to use.
+typedef struct {
+    int state;  // 0: unlocked, 1: locked, 2: locked and maybe contended
+} mutex_t;
+
+typedef struct {
+    int seq;  // bumped by every signal
+} cond_t;
+
+typedef struct {
+    int count;
+    int waiters;
+} sem_t;
+
+void mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+void cond_wait(cond_t *c, mutex_t *m);
+void cond_signal(cond_t *c);
+void cond_broadcast(cond_t *c);
+void sem_init(sem_t *s, int count);
+void sem_wait(sem_t *s);
+void sem_post(sem_t *s);
+
 // assert
 #define _STRINGIFY(s) #s
 #define STRINGIFY(s)  _STRINGIFY(s)
@@ -17,6 +17,8 @@ sub entry {
 	
 entry("fork");
 entry("exec");
+entry("spawn");
+entry("vfork");
 entry("exit");
 entry("wait");
 entry("kill");
@@ -24,6 +26,15 @@ entry("getpid");
 entry("getppid");
 entry("sleep");
 entry("yield");
+entry("setnice");
+entry("nanosleep");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("sched_setattr");
+entry("sched_isolate");
+entry("clone");
+entry("futex_wait");
+entry("futex_wake");
 entry("sbrk");
 entry("mmap");
 entry("read");
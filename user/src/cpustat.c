@@ -0,0 +1,8 @@
+#include "../../os/ktest/ktest.h"
+#include "../lib/user.h"
+
+// print per-hart idle residency, timer interrupt, migration and kernel preemption counts.
+int main(int argc, char *argv[]) {
+    ktest(KTEST_PRINT_CPUSTAT, 0, 0);
+    return 0;
+}
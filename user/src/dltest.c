@@ -0,0 +1,94 @@
+#include "../lib/user.h"
+
+// deadline scheduling test: a periodic job does WORK_US of computation every PERIOD_US,
+//  under background fork/exit/wait load on every hart. It runs once in the fair class,
+//  and once in the deadline class, and reports how many periods finished after their deadline.
+
+#define NLOADERS  (8)
+#define NPERIODS  (100)
+#define PERIOD_US (20000)
+#define WORK_US   (3000)
+
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+static volatile uint64 sink;
+static void spin(uint64 iters) {
+    for (uint64 i = 0; i < iters; i++)
+        sink = sink * 31 + i;
+}
+
+// like forkfork in proctest: keep creating and reaping processes.
+static void loader() {
+    for (;;) {
+        int pid = fork();
+        if (pid == 0)
+            exit(0);
+        if (pid > 0)
+            wait(pid, NULL);
+        spin(10000);
+    }
+}
+
+static void sleep_until(uint64 t) {
+    uint64 now = now_us();
+    if (now >= t)
+        return;
+    TimeSpec ts = {.sec = (t - now) / 1000000, .nsec = (t - now) % 1000000 * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static int run_periods(uint64 iters) {
+    int misses   = 0;
+    uint64 start = now_us() + PERIOD_US;
+    for (int i = 0; i < NPERIODS; i++) {
+        uint64 release = start + (uint64)i * PERIOD_US;
+        sleep_until(release);
+        spin(iters);
+        if (now_us() > release + PERIOD_US)
+            misses++;
+    }
+    return misses;
+}
+
+int main(int argc, char *argv[]) {
+    // calibrate the work on an idle system.
+    uint64 t0 = now_us();
+    spin(1000000);
+    uint64 elapsed = now_us() - t0;
+    uint64 iters   = 1000000UL * WORK_US / (elapsed ? elapsed : 1);
+
+    int pids[NLOADERS];
+    for (int i = 0; i < NLOADERS; i++) {
+        if ((pids[i] = fork()) == 0)
+            loader();
+    }
+
+    int fair_misses = run_periods(iters);
+
+    // reserve twice the work, for the time the kernel spends on our behalf.
+    struct sched_attr attr = {
+        .runtime  = 2 * WORK_US * 1000,
+        .deadline = PERIOD_US * 1000,
+        .period   = PERIOD_US * 1000,
+    };
+    int ret = sched_setattr(&attr);
+    if (ret < 0)
+        printf("dltest: sched_setattr failed: %d\n", ret);
+    int dl_misses = ret < 0 ? -1 : run_periods(iters);
+    attr.runtime = 0;
+    sched_setattr(&attr);
+
+    for (int i = 0; i < NLOADERS; i++) {
+        kill(pids[i]);
+        wait(pids[i], NULL);
+    }
+
+    printf("dltest: %d periods of %d us, %d us of work each, %d loaders\n", NPERIODS, PERIOD_US, WORK_US, NLOADERS);
+    printf("  fair class:     %d deadline misses\n", fair_misses);
+    printf("  deadline class: %d deadline misses\n", dl_misses);
+    return 0;
+}
@@ -9,14 +9,9 @@ int main(void) {
 
     for (;;) {
         printf("init: starting sh\n");
-        pid = fork();
+        pid = spawn("sh", argv);
         if (pid < 0) {
-            printf("init: fork failed\n");
-            exit(1);
-        }
-        if (pid == 0) {
-            exec("sh", argv);
-            printf("init: exec sh failed\n");
+            printf("init: spawn sh failed\n");
             exit(1);
         }
 
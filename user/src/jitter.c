@@ -0,0 +1,64 @@
+#include "../lib/user.h"
+
+// jitter test: a process pinned to the last hart timestamps a tight loop,
+//  and reports the gaps between consecutive timestamps, i.e., the time it lost to the kernel.
+//  It runs with background load on every hart, once with the hart shared, and once with it isolated.
+
+#define NLOADERS   (8)
+#define RUN_US     (2000000)
+#define GAP_US     (50)  // a gap longer than this is an interruption
+#define TEST_CPU   (3)
+
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+static void measure(char *name) {
+    uint64 start = now_us();
+    uint64 prev  = start;
+    uint64 max = 0, gaps = 0, loops = 0;
+    while (prev - start < RUN_US) {
+        uint64 now = now_us();
+        if (now - prev > max)
+            max = now - prev;
+        if (now - prev > GAP_US)
+            gaps++;
+        prev = now;
+        loops++;
+    }
+    printf("  %s: %d loops, %d gaps over %d us, max gap %d us\n", name, (int)loops, (int)gaps, GAP_US, (int)max);
+}
+
+int main(int argc, char *argv[]) {
+    int pids[NLOADERS];
+    for (int i = 0; i < NLOADERS; i++) {
+        if ((pids[i] = fork()) == 0) {
+            for (;;)
+                ;
+        }
+    }
+    if (sched_setaffinity(0, 1UL << TEST_CPU) < 0) {
+        printf("jitter: sched_setaffinity failed\n");
+        exit(1);
+    }
+
+    printf("jitter: %d us on hart %d, %d busy loaders\n", RUN_US, TEST_CPU, NLOADERS);
+    measure("shared  ");
+
+    if (sched_isolate(1UL << TEST_CPU) < 0) {
+        printf("jitter: sched_isolate failed\n");
+        exit(1);
+    }
+    // wait for the loaders to move away.
+    sleep(10);
+    measure("isolated");
+    sched_isolate(0);
+
+    for (int i = 0; i < NLOADERS; i++) {
+        kill(pids[i]);
+        wait(pids[i], NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include "../../os/ktest/ktest.h"
+#include "../lib/user.h"
+
+// lock microbenchmark: one process per hart takes and releases the same kernel lock for a while,
+//  with the old test-and-set lock, a ticket lock and an MCS lock.
+//  Reports the total throughput, and fairness as the fewest acquisitions of a hart relative to the most.
+
+#define NHARTS  (4)
+#define RUN_US  (500000)
+
+static char *kinds[] = {"test-and-set", "ticket", "mcs"};
+
+int main(int argc, char *argv[]) {
+    printf("lockbench: %d harts, %d ms per lock\n", NHARTS, RUN_US / 1000);
+    for (int kind = LOCKBENCH_TAS; kind <= LOCKBENCH_MCS; kind++) {
+        int pids[NHARTS];
+        for (int i = 0; i < NHARTS; i++) {
+            if ((pids[i] = fork()) == 0) {
+                if (sched_setaffinity(0, 1UL << i) < 0)
+                    exit(-1);
+                exit(ktest(KTEST_LOCKBENCH, (void *)(uint64)(kind | NHARTS << 8), RUN_US));
+            }
+        }
+        uint64 total = 0, min = -1, max = 0;
+        int counts[NHARTS];
+        for (int i = 0; i < NHARTS; i++) {
+            wait(pids[i], &counts[i]);
+            if (counts[i] < 0) {
+                printf("lockbench: %s failed\n", kinds[kind]);
+                exit(1);
+            }
+            total += counts[i];
+            if (counts[i] < min)
+                min = counts[i];
+            if (counts[i] > max)
+                max = counts[i];
+        }
+        printf("  %s: %d acquisitions/ms, fairness %d%% (", kinds[kind], (int)(total * 1000 / RUN_US),
+               (int)(max ? min * 100 / max : 0));
+        for (int i = 0; i < NHARTS; i++)
+            printf(i ? " %d" : "%d", counts[i]);
+        printf(")\n");
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "../../os/ktest/ktest.h"
+#include "../lib/user.h"
+
+// lock contention profile of a workload: `lockstat prog args...` resets the kernel's lock statistics,
+//  runs prog, and prints them when it exits. Without arguments, prints the statistics since boot.
+//  The kernel must be built with `make LOCKSTAT=y`.
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        if (ktest(KTEST_PRINT_LOCKSTAT, 0, 0) < 0) {
+            printf("lockstat: not built with LOCKSTAT=y\n");
+            exit(1);
+        }
+        return 0;
+    }
+
+    if (ktest(KTEST_PRINT_LOCKSTAT, (void *)1, 0) < 0) {
+        printf("lockstat: not built with LOCKSTAT=y\n");
+        exit(1);
+    }
+    int pid = spawn(argv[1], &argv[1]);
+    if (pid < 0) {
+        printf("lockstat: cannot run %s\n", argv[1]);
+        exit(1);
+    }
+    int code;
+    wait(pid, &code);
+    printf("lockstat: %s exited with %d\n", argv[1], code);
+    ktest(KTEST_PRINT_LOCKSTAT, 0, 0);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "../../os/ktest/ktest.h"
+#include "../lib/user.h"
+
+// kernel preemption test: a probe sleeps 1ms at a time, and measures how late it wakes up,
+//  while loaders on the same hart keep spawning and reaping `verybig`, whose exec() clears 4MB of bss in the kernel.
+//  It runs once in every preemption mode; the kernel's wakeup latency histogram follows each run.
+
+#define NLOADERS (2)
+#define NPROBES  (500)
+#define TEST_CPU (1)
+
+static char *modes[] = {"none", "voluntary", "full"};
+
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+static void loader() {
+    char *argv[] = {"verybig", NULL};
+    for (;;) {
+        int pid = spawn("verybig", argv);
+        if (pid < 0)
+            continue;
+        kill(pid);
+        wait(pid, NULL);
+    }
+}
+
+static void probe(char *mode) {
+    TimeSpec req = {.sec = 0, .nsec = 1000000};
+    uint64 max = 0, sum = 0, over100 = 0;
+    for (int i = 0; i < NPROBES; i++) {
+        uint64 start = now_us();
+        nanosleep(&req, NULL);
+        uint64 slept = now_us() - start;
+        uint64 late  = slept > 1000 ? slept - 1000 : 0;
+        sum += late;
+        if (late > max)
+            max = late;
+        if (late > 100)
+            over100++;
+    }
+    printf("  %s: late avg %d us, max %d us, %d of %d over 100 us\n", mode, (int)(sum / NPROBES), (int)max,
+           (int)over100, NPROBES);
+}
+
+int main(int argc, char *argv[]) {
+    if (sched_setaffinity(0, 1UL << TEST_CPU) < 0) {
+        printf("preemptlat: sched_setaffinity failed\n");
+        exit(1);
+    }
+    int pids[NLOADERS];
+    for (int i = 0; i < NLOADERS; i++) {
+        if ((pids[i] = fork()) == 0)
+            loader();
+    }
+
+    printf("preemptlat: %d sleeps of 1ms on hart %d, %d loaders\n", NPROBES, TEST_CPU, NLOADERS);
+    for (int mode = 0; mode <= 2; mode++) {
+        ktest(KTEST_SET_PREEMPT, (void *)(uint64)mode, 0);
+        ktest(KTEST_PRINT_LATHIST, (void *)1, 0);
+        probe(modes[mode]);
+        ktest(KTEST_PRINT_LATHIST, 0, 0);
+    }
+
+    for (int i = 0; i < NLOADERS; i++) {
+        kill(pids[i]);
+        wait(pids[i], NULL);
+    }
+    return 0;
+}
@@ -357,6 +357,284 @@ void nowrite(char *s) {
     exit(0);
 }
 
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+// nanosleep sleeps at least as long as asked,
+// and sleepers with shorter timeouts wake up first.
+void sleeporder(char *s) {
+    TimeSpec ts = {.sec = 0, .nsec = 5000000};
+    uint64 t0   = now_us();
+    if (nanosleep(&ts, NULL) != 0) {
+        printf("%s: nanosleep failed\n", s);
+        exit(1);
+    }
+    uint64 t1 = now_us();
+    if (t1 - t0 < 5000) {
+        printf("%s: woke up after %d us\n", s, (int)(t1 - t0));
+        exit(1);
+    }
+
+    int pids[3];
+    for (int i = 0; i < 3; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pids[i] == 0) {
+            TimeSpec t = {.sec = 0, .nsec = (3 - i) * 20000000};
+            nanosleep(&t, NULL);
+            exit(0);
+        }
+    }
+    for (int i = 2; i >= 0; i--) {
+        int xst;
+        if (wait(-1, &xst) != pids[i]) {
+            printf("%s: sleepers woke up out of order\n", s);
+            exit(1);
+        }
+    }
+    exit(0);
+}
+
+// FP registers survive context switches between processes using them.
+void fpregs(char *s) {
+    int pids[4];
+    for (int i = 0; i < 4; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pids[i] == 0) {
+            volatile double x = i + 1;
+            double sum        = 0;
+            for (int j = 0; j < 1000; j++) {
+                sum += x * 0.5;
+                if (j % 10 == 0)
+                    yield();
+            }
+            exit(sum == (i + 1) * 500.0 ? 0 : 1);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        int xst;
+        wait(-1, &xst);
+        if (xst != 0) {
+            printf("%s: FP state corrupted\n", s);
+            exit(1);
+        }
+    }
+    exit(0);
+}
+
+// a vfork() child runs in our address space, and we resume only after it exits.
+volatile int vfork_shared;
+void vforkshare(char *s) {
+    vfork_shared = 0;
+    int pid      = vfork();
+    if (pid < 0) {
+        printf("%s: vfork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        vfork_shared = 1;
+        exit(7);
+    }
+    if (vfork_shared != 1) {
+        printf("%s: parent resumed before the child exited\n", s);
+        exit(1);
+    }
+    int xst;
+    if (wait(pid, &xst) != pid || xst != 7) {
+        printf("%s: wait for the vfork child failed\n", s);
+        exit(1);
+    }
+    exit(0);
+}
+
+// spawn() starts a program as our child, and fails cleanly on a missing one.
+void spawnbasic(char *s) {
+    char *argv[] = {"true", NULL};
+    if (spawn("nonexisting", argv) >= 0) {
+        printf("%s: spawn of a missing program succeeded\n", s);
+        exit(1);
+    }
+    int pid = spawn("true", argv);
+    if (pid < 0) {
+        printf("%s: spawn failed\n", s);
+        exit(1);
+    }
+    int xst;
+    if (wait(pid, &xst) != pid || xst != 0) {
+        printf("%s: wait for the spawned child failed\n", s);
+        exit(1);
+    }
+    exit(0);
+}
+
+// threads share memory, and join returns their results.
+static volatile int thread_counts[4];
+static void *thread_count(void *arg) {
+    int i = (int)(uint64)arg;
+    for (int j = 0; j < 1000; j++) {
+        thread_counts[i]++;
+        if (j % 100 == 0)
+            yield();
+    }
+    return (void *)(uint64)(i + 10);
+}
+
+void threads(char *s) {
+    pthread_t t[4];
+    for (int i = 0; i < 4; i++) {
+        thread_counts[i] = 0;
+        if (pthread_create(&t[i], thread_count, (void *)(uint64)i) != 0) {
+            printf("%s: pthread_create failed\n", s);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        void *ret;
+        if (pthread_join(t[i], &ret) != 0 || (uint64)ret != i + 10) {
+            printf("%s: pthread_join failed\n", s);
+            exit(1);
+        }
+        if (thread_counts[i] != 1000) {
+            printf("%s: thread %d counted %d\n", s, i, thread_counts[i]);
+            exit(1);
+        }
+    }
+    exit(0);
+}
+
+// mutex-protected counting from threads, a semaphore handoff, and futex timeouts.
+static mutex_t sync_lock;
+static int sync_count;
+static sem_t sync_sem;
+static void *sync_worker(void *arg) {
+    for (int i = 0; i < 1000; i++) {
+        mutex_lock(&sync_lock);
+        sync_count++;
+        mutex_unlock(&sync_lock);
+    }
+    sem_post(&sync_sem);
+    return NULL;
+}
+
+void futexsync(char *s) {
+    int word    = 0;
+    TimeSpec ts = {.sec = 0, .nsec = 10000000};
+    if (futex_wait(&word, 1, NULL) != -EAGAIN || futex_wait(&word, 0, &ts) != -ETIMEDOUT) {
+        printf("%s: futex_wait returned wrong errors\n", s);
+        exit(1);
+    }
+
+    pthread_t t[4];
+    sync_count = 0;
+    sem_init(&sync_sem, 0);
+    for (int i = 0; i < 4; i++) {
+        if (pthread_create(&t[i], sync_worker, NULL) != 0) {
+            printf("%s: pthread_create failed\n", s);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < 4; i++)
+        sem_wait(&sync_sem);
+    if (sync_count != 4000) {
+        printf("%s: counted %d under the mutex\n", s, sync_count);
+        exit(1);
+    }
+    for (int i = 0; i < 4; i++)
+        pthread_join(t[i], NULL);
+    exit(0);
+}
+
+// the cpu affinity mask is validated, and inherited across fork.
+void affinity(char *s) {
+    if (sched_setaffinity(0, 0) >= 0) {
+        printf("%s: empty mask accepted\n", s);
+        exit(1);
+    }
+    if (sched_setaffinity(0, 2) != 0 || sched_getaffinity(0) != 2) {
+        printf("%s: sched_setaffinity failed\n", s);
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < 10; i++)
+            yield();
+        exit(sched_getaffinity(0) == 2 ? 0 : 1);
+    }
+    int xst;
+    wait(pid, &xst);
+    if (xst != 0) {
+        printf("%s: child did not inherit the mask\n", s);
+        exit(1);
+    }
+    exit(0);
+}
+
+// heap pages come zeroed, even when just freed with junk in them,
+//  and the memory of an exited child is all back once it is reaped.
+void sbrkzero(char *s) {
+    enum { NPAGES = 64 };
+    int freemem = getfreemem();
+
+    int pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        for (int round = 0; round < 4; round++) {
+            char *a = sbrk(NPAGES * PGSIZE);
+            if (a == (char *)-1) {
+                printf("%s: sbrk failed\n", s);
+                exit(1);
+            }
+            for (int i = 0; i < NPAGES * PGSIZE; i++) {
+                if (a[i] != 0) {
+                    printf("%s: round %d, byte %d is %d\n", s, round, i, a[i]);
+                    exit(1);
+                }
+            }
+            memset(a, 0x5a, NPAGES * PGSIZE);
+            sbrk(-NPAGES * PGSIZE);
+        }
+        // leave a dirty heap for exit() to free.
+        memset(sbrk(NPAGES * PGSIZE), 0x5a, NPAGES * PGSIZE);
+        exit(0);
+    }
+    int xst;
+    assert_eq(wait(pid, &xst), pid);
+    assert_eq(xst, 0);
+    assert_eq(getfreemem(), freemem);
+    exit(0);
+}
+
+// reaped procs are only reused after an RCU grace period,
+//  which must come soon enough for many more processes than the kernel's table to come and go.
+void procreuse(char *s) {
+    enum { N = 1024 };
+    for (int i = 0; i < N; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("%s: fork %d failed\n", s, i);
+            exit(1);
+        }
+        if (pid == 0)
+            exit(0);
+        assert_eq(wait(pid, NULL), pid);
+    }
+    exit(0);
+}
+
 struct test {
     void (*f)(char *);
     char *s;
@@ -371,6 +649,15 @@ struct test {
     {sbrkmuch,    "sbrkmuch"   },
     {bsstest,     "bsstest"    },
     {nowrite,     "nowrite"    },
+    {sleeporder,  "sleeporder" },
+    {fpregs,      "fpregs"     },
+    {vforkshare,  "vforkshare" },
+    {spawnbasic,  "spawnbasic" },
+    {threads,     "threads"    },
+    {futexsync,   "futexsync"  },
+    {affinity,    "affinity"   },
+    {sbrkzero,    "sbrkzero"   },
+    {procreuse,   "procreuse"  },
     {NULL,        NULL         },
 };
 
@@ -0,0 +1,46 @@
+#include "../../os/ktest/ktest.h"
+#include "../lib/user.h"
+
+// MPMC queue stress test, for `make runsmp`: 1, 2 and then 4 processes, each on its own hart,
+//  push and pop through a small kernel queue. The kernel checks that no value is lost or duplicated,
+//  and we report the throughput of each round.
+
+#define NHARTS (4)
+#define OPS    (200000)  // pushes per hart
+
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+int main(int argc, char *argv[]) {
+    printf("queuetest: %d pushes per hart\n", OPS);
+    for (int nr = 1; nr <= NHARTS; nr *= 2) {
+        int pids[NHARTS];
+        ktest(KTEST_QUEUE_STRESS, 0, 0);
+        uint64 start = now_us();
+        for (int i = 0; i < nr; i++) {
+            if ((pids[i] = fork()) == 0) {
+                if (sched_setaffinity(0, 1UL << i) < 0)
+                    exit(-1);
+                exit(ktest(KTEST_QUEUE_STRESS, (void *)(uint64)nr, OPS));
+            }
+        }
+        int failed = 0;
+        for (int i = 0; i < nr; i++) {
+            int code;
+            wait(pids[i], &code);
+            if (code < 0)
+                failed = 1;
+        }
+        uint64 us = now_us() - start;
+        if (failed) {
+            printf("queuetest: %d harts: FAILED\n", nr);
+            exit(1);
+        }
+        printf("  %d harts: %d push+pop per ms\n", nr, (int)((uint64)nr * OPS * 1000 / (us ? us : 1)));
+    }
+    printf("queuetest: OK\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "../lib/user.h"
+
+// process creation benchmark: launch `true` with fork+exec, vfork+exec and spawn.
+//  The parent touches a heap first, so that fork() has something to copy.
+
+#define NRUNS     (200)
+#define HEAP_SIZE (256 * 1024)
+
+static char *true_argv[] = {"true", NULL};
+
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+static int launch(int how) {
+    int pid;
+    switch (how) {
+        case 0:
+            pid = fork();
+            break;
+        case 1:
+            pid = vfork();
+            break;
+        default:
+            return spawn("true", true_argv);
+    }
+    if (pid == 0) {
+        exec("true", true_argv);
+        exit(-1);
+    }
+    return pid;
+}
+
+static uint64 run(int how) {
+    uint64 start = now_us();
+    for (int i = 0; i < NRUNS; i++) {
+        int pid = launch(how);
+        if (pid < 0) {
+            printf("spawnbench: launch failed\n");
+            exit(1);
+        }
+        int xstatus;
+        wait(pid, &xstatus);
+        if (xstatus != 0) {
+            printf("spawnbench: child exited with %d\n", xstatus);
+            exit(1);
+        }
+    }
+    return now_us() - start;
+}
+
+int main(int argc, char *argv[]) {
+    char *heap = sbrk(HEAP_SIZE);
+    for (int i = 0; i < HEAP_SIZE; i += 4096)
+        heap[i] = 1;
+
+    static const char *names[] = {"fork+exec ", "vfork+exec", "spawn     "};
+    printf("spawnbench: %d launches, %d KB heap\n", NRUNS, HEAP_SIZE / 1024);
+    for (int how = 0; how < 3; how++) {
+        uint64 us = run(how);
+        printf("  %s: %d us, %d us per launch\n", names[how], (int)us, (int)(us / NRUNS));
+    }
+    return 0;
+}
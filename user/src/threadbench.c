@@ -0,0 +1,42 @@
+#include "../lib/user.h"
+
+// parallel compute benchmark: split a CPU-bound loop over 1, 2 and 4 threads.
+
+#define NITERS   (40000000)
+#define MAX_THRS (4)
+
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+static void *work(void *arg) {
+    uint64 n = (uint64)arg;
+    uint64 x = 0;
+    for (uint64 i = 0; i < n; i++)
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+    return (void *)x;
+}
+
+int main(int argc, char *argv[]) {
+    printf("threadbench: %d iterations\n", NITERS);
+    uint64 base = 0;
+    for (int nthrs = 1; nthrs <= MAX_THRS; nthrs *= 2) {
+        pthread_t t[MAX_THRS];
+        uint64 start = now_us();
+        for (int i = 0; i < nthrs; i++) {
+            if (pthread_create(&t[i], work, (void *)(uint64)(NITERS / nthrs)) != 0) {
+                printf("threadbench: pthread_create failed\n");
+                exit(1);
+            }
+        }
+        for (int i = 0; i < nthrs; i++)
+            pthread_join(t[i], NULL);
+        uint64 us = now_us() - start;
+        if (nthrs == 1)
+            base = us;
+        printf("  %d threads: %d us, speedup x%d.%d\n", nthrs, (int)us, (int)(base / us), (int)(base * 10 / us % 10));
+    }
+    return 0;
+}
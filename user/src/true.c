@@ -0,0 +1,7 @@
+#include "../lib/user.h"
+
+// does nothing, successfully. used by spawnbench.
+
+int main(int argc, char *argv[]) {
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "../../os/ktest/ktest.h"
+#include "../lib/user.h"
+
+// ping-pong yield benchmark: more yielding processes than harts,
+//  so that every yield() switches to another process.
+
+#define NPROCS  (8)
+#define NYIELDS (2000)
+
+static uint64 now_us() {
+    TimeVal tv;
+    gettimeofday(&tv, NULL);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+static uint64 run(int direct) {
+    ktest(KTEST_SET_DIRECT_SWITCH, (void *)(uint64)direct, 0);
+
+    uint64 start = now_us();
+    for (int i = 0; i < NPROCS; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("yieldbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            for (int j = 0; j < NYIELDS; j++)
+                yield();
+            exit(0);
+        }
+    }
+    for (int i = 0; i < NPROCS; i++) {
+        int xstatus;
+        wait(-1, &xstatus);
+    }
+    return now_us() - start;
+}
+
+int main(int argc, char *argv[]) {
+    uint64 via_sched = run(0);
+    uint64 direct    = run(1);
+    printf("yieldbench: %d processes x %d yields\n", NPROCS, NYIELDS);
+    printf("  via scheduler: %d us, %d ns per yield\n", (int)via_sched, (int)(via_sched * 1000 / (NPROCS * NYIELDS)));
+    printf("  direct switch: %d us, %d ns per yield\n", (int)direct, (int)(direct * 1000 / (NPROCS * NYIELDS)));
+    return 0;
+}